@@ -0,0 +1,155 @@
+/*
+ * =====================================================================================
+ *
+ * Filename:  libtodo.h
+ *
+ * Description:  The to-do list store as a library (libtodo.a / libtodo.so),
+ * for programs that want to keep a list open in-process instead of
+ * running ./todo once per command.
+ *
+ * A TodoStore is one task file, loaded when opened and written back by
+ * todoSave(). Tasks are numbered from 1 in list order, as in the menu and
+ * the HTTP API. A store may be used by one thread at a time, or by many
+ * if libtodo was built with -DTODO_LOCKING=TODO_LOCKING_MUTEX.
+ *
+ * The functions below, their arguments and TodoTask's layout only change
+ * along with TODO_ABI_VERSION (and the shared library's soname); new
+ * functions may be added without it.
+ *
+ * =====================================================================================
+ */
+
+#ifndef LIBTODO_H
+#define LIBTODO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TODO_ABI_VERSION 1
+
+#if defined(__GNUC__)
+#define TODO_API __attribute__((visibility("default")))
+#else
+#define TODO_API
+#endif
+
+// An open task file. Opaque: only used through the functions below.
+typedef struct TodoStore TodoStore;
+
+// One task, as passed to a TodoVisitor.
+typedef struct TodoTask {
+    int index;                       // 1-based position in the list
+    unsigned long id;                // Stays the same while the store is open
+    int completed;                   // 0 = incomplete, 1 = complete
+    const char* description;         // Only valid during the call
+} TodoTask;
+
+// Called for each task by todoIterate() and todoSearch(). Return 0 to go
+// on, anything else to stop (the caller then returns that value).
+typedef int (*TodoVisitor)(const TodoTask* task, void* context);
+
+/**
+ * @brief Returns the ABI the library was built with, to check against
+ * TODO_ABI_VERSION at run time.
+ */
+TODO_API int todoAbiVersion(void);
+
+/**
+ * @brief Opens a task file, loading its tasks. A file that doesn't exist
+ * yet gives an empty store; todoSave() creates it.
+ * @param path The file (fewer than 72 characters).
+ * @return The store, or NULL (with errno set) if the file couldn't be read.
+ */
+TODO_API TodoStore* todoOpen(const char* path);
+
+/**
+ * @brief Appends a task, in memory only: todoSave() writes it (or the
+ * next todoAddBatch(), todoMarkBatch() or todoDeleteBatch() that changes
+ * the list). Descriptions longer than 255 bytes are cut, as
+ * is anything from the first '\r' or '\n' on (a task is one line).
+ * @return The new task's index, or -1 (errno EINVAL) if the description
+ * is empty once cut.
+ */
+TODO_API int todoAdd(TodoStore* store, const char* description);
+
+/**
+ * @brief Marks a task complete, in memory only: todoSave() writes it.
+ * @return 0, or -1 if there's no task at that index.
+ */
+TODO_API int todoMark(TodoStore* store, int index);
+
+/**
+ * @brief Deletes a task, in memory only: todoSave() writes it. The tasks
+ * after it move up by one.
+ * @return 0, or -1 if there's no task at that index.
+ */
+TODO_API int todoDelete(TodoStore* store, int index);
+
+/**
+ * @brief Appends many tasks, as one change, and writes them to the file
+ * in one write (or saves the whole list, if it has unsaved changes).
+ * Descriptions are cut as by todoAdd().
+ * @return How many were added, or -1 (with errno set) if the file
+ * couldn't be written; the tasks are added either way. If any
+ * description is empty once cut, none are added and errno is EINVAL.
+ */
+TODO_API int todoAddBatch(TodoStore* store, const char* const* descriptions, int count);
+
+/**
+ * @brief Marks many tasks complete, as one change, then saves the whole
+ * list (with any other unsaved changes) unless none of them changed.
+ * Unlike todoMark(), the marks are on disk when it returns.
+ * @param indices 1-based indices, in any order; ones out of range or
+ * repeated are skipped.
+ * @return How many tasks are now marked, or -1 (with errno set) if the
+ * file couldn't be written; they're marked either way.
+ */
+TODO_API int todoMarkBatch(TodoStore* store, const int* indices, int count);
+
+/**
+ * @brief Deletes many tasks, as one change, then saves the whole list
+ * (with any other unsaved changes) unless none were deleted. Unlike
+ * todoDelete(), the deletes are on disk when it returns.
+ * @param indices 1-based indices as they were before the call, in any
+ * order; ones out of range or repeated are skipped.
+ * @return How many were deleted, or -1 (with errno set) if the file
+ * couldn't be written; they're deleted either way.
+ */
+TODO_API int todoDeleteBatch(TodoStore* store, const int* indices, int count);
+
+/**
+ * @brief Returns how many tasks the store holds.
+ */
+TODO_API int todoCount(TodoStore* store);
+
+/**
+ * @brief Calls 'visit' for every task, in order. The tasks seen are the
+ * list as it was when the call started, even if 'visit' changes it.
+ * @return 0, or what 'visit' returned to stop early.
+ */
+TODO_API int todoIterate(TodoStore* store, TodoVisitor visit, void* context);
+
+/**
+ * @brief Like todoIterate(), but only for tasks whose description
+ * contains 'query' (case-sensitive).
+ * @return 0, or what 'visit' returned to stop early.
+ */
+TODO_API int todoSearch(TodoStore* store, const char* query, TodoVisitor visit, void* context);
+
+/**
+ * @brief Writes the tasks to the store's file.
+ * @return 0, or -1 (with errno set) if the file couldn't be written.
+ */
+TODO_API int todoSave(TodoStore* store);
+
+/**
+ * @brief Frees the store. Unsaved changes are lost.
+ */
+TODO_API void todoClose(TodoStore* store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBTODO_H
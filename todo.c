@@ -11,60 +11,1144 @@
  * - Dynamic Memory Allocation (malloc, free)
  * - File I/O (fopen, fprintf, fgets, fclose)
  * - String Manipulation (strcpy, fgets, sscanf)
+ * - Multi-Version Records (MVCC) for consistent snapshot reads
+ * - Sockets and poll() for a small local HTTP/JSON server
+ * - Ring buffers for change notifications
+ * - inotify for noticing external edits to the task file
+ * - Log-shipping replication to standby processes over a Unix socket
+ * - Restarting (e.g. after an upgrade) without dropping connections
+ * - Coroutine-style async jobs, with blocking calls on a worker thread
+ * - Workspaces of many named lists, loaded on demand within a memory budget
+ * - The same store as an embeddable library, libtodo (see libtodo.h)
  *
  * =====================================================================================
  */
 
+#define _GNU_SOURCE // accept4(), strcasestr(), memfd_create()
+
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "libtodo.h"
 
 // --- Constants ---
 #define MAX_TASK_LEN 256
-#define FILENAME "tasks.txt"
+#define FILENAME "tasks.txt"     // The main list's file
+#define LIST_NAME_MAX 64        // Longest list name in a workspace, plus the NUL
+#define DEFAULT_MEMORY_BUDGET_MB 256 // Loaded lists before the least recently used are dropped
+#define VERSION_INFINITY ULONG_MAX // 'endVersion' of a record nobody has replaced yet
+#define HTTP_MAX_CLIENTS 64     // Concurrent connections the server accepts
+#define HTTP_BUFFER_SIZE 16384  // Per-connection input and output buffer
+#define HTTP_MAX_PATH 256       // Longest request target we parse
+#define HTTP_MAX_BODY 1024      // Longest request body (a task description)
+#define HTTP_CHUNK_HEADER 8     // "XXXXXX\r\n": fixed-width chunk-size line
+#define HTTP_MAX_PIPELINE 32    // Queued requests per connection before we stop reading it
+#define HTTP_MAX_QUEUED 512     // Queued requests in all before we stop reading at all
+#define HTTP_REQUEST_BUDGET 8   // Requests one connection may run per loop turn
+#define HTTP_QUEUE_DEADLINE_MS 200 // Requests queued longer than this are refused with 503
+#define SUBSCRIBER_RING_SIZE 1024 // Change events a subscriber may fall behind by
+#define REPL_MAX_FOLLOWERS 8    // Standby processes a leader feeds
+#define REPL_BUFFER_SIZE 65536  // Per-follower replication stream buffer
+#define REPL_HEARTBEAT_MS 100   // How often a leader tells followers its version
+#define HANDOFF_MAGIC "TODOHOF1" // First bytes of a restart state file
+#define HANDOFF_MAX_FDS 4       // Most descriptors passed in one handoff message
+#define SAVE_BATCH 4096         // Tasks an async save formats before yielding
+#define SHARD_MAX 64            // Most --threads
+#define SHARD_REQUEST_SLOTS 16  // Requests in flight from one shard to another
+#define SHARD_RESPONSE_SLOTS 4  // Response pieces in flight back from one shard to another
+#define SHARD_POLL_MS 200       // Longest a shard waits before checking for a stop
+#define BENCH_FILE "bench-tasks.txt" // Scratch file for the save/load benchmarks
+#define BENCH_DEFAULT_MAX 1000000 // Largest list --bench times by default
+#define LATENCY_SUB_BITS 5      // Histogram precision: 2^(bits-1) buckets per power of two
+#define LATENCY_HALF (1 << (LATENCY_SUB_BITS - 1))
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 2) * LATENCY_HALF) // Covers every long long
+#define DEFAULT_SEED 42          // --seed when none is given: same files every run
+#define DEFAULT_COMPLETED_PERCENT 30 // Share of generated tasks already done
+#define TRACE_RING_SIZE 65536   // Spans each thread keeps for --trace (oldest overwritten)
+#define PERF_COUNTERS 5         // Hardware events --bench --counters reads
+#define METRICS_PAGE_SIZE 8192  // Room for the GET /metrics page
+#define LOAD_SAMPLE_EVERY 16    // Lines per line timed phase by phase when profiling a load
+#define BENCH_STARTUP_DIR "bench-startup" // Scratch workspace for --bench-startup
+#define BENCH_STARTUP_DEFAULT_MAX 1000000 // Largest task file --bench-startup times by default
+#define BENCH_STARTUP_RUNS 5    // Starts timed per file size and cache state
+#define BENCH_INDEXED_WORK 100000000L // Tasks walked by the timed mark (or delete) calls, per size
+#define BENCH_BATCH_SIZE 1000   // Tasks per call in the batch benchmarks
+#define MONOTONIC_CHUNK (1 << 20) // Bytes the monotonic resource takes from malloc at a time
+#define POOL_GRAIN 16           // Pool block sizes are multiples of this...
+#define POOL_CLASSES 64         // ...up to POOL_GRAIN * POOL_CLASSES bytes; bigger go to malloc
+#define POOL_SLAB (64 * 1024)   // Bytes the pool carves into blocks at a time
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) // Slab of the huge-page pool: one huge page
+
+// --- Build Policies ---
+//
+// How tasks are stored is picked when compiling, e.g.
+//   gcc -O2 -DTODO_STORAGE=TODO_STORAGE_INDEXED todo.c -o todo
+// so each build pays only for the choice it made. The defaults are the
+// original design. "make bench-policies" benchmarks every combination.
+//
+// TODO_STORAGE      LIST: finding the Nth task walks the list (O(N)).
+//                   INDEXED: the list also keeps an array of its live
+//                   tasks in order, so finding the Nth task is O(1);
+//                   inserting and deleting shift the array's tail.
+// TODO_DESCRIPTION  INLINE: every task carries a MAX_TASK_LEN buffer.
+//                   EXACT: the text is allocated with the task, sized
+//                   to fit (so short tasks take far less memory).
+// TODO_LOCKING      NONE: a list is only ever used by one thread at a time.
+//                   MUTEX: each list has a mutex its operations hold, so
+//                   threads may share a list.
+#define TODO_STORAGE_LIST 0
+#define TODO_STORAGE_INDEXED 1
+#define TODO_DESCRIPTION_INLINE 0
+#define TODO_DESCRIPTION_EXACT 1
+#define TODO_LOCKING_NONE 0
+#define TODO_LOCKING_MUTEX 1
+
+#ifndef TODO_STORAGE
+#define TODO_STORAGE TODO_STORAGE_LIST
+#endif
+#ifndef TODO_DESCRIPTION
+#define TODO_DESCRIPTION TODO_DESCRIPTION_INLINE
+#endif
+#ifndef TODO_LOCKING
+#define TODO_LOCKING TODO_LOCKING_NONE
+#endif
+
+// Bytes to allocate for a Task whose description is 'length' characters.
+#if TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT
+#define TASK_SIZE(length) (sizeof(Task) + (length) + 1)
+#else
+#define TASK_SIZE(length) sizeof(Task)
+#endif
+
+// Holds the list's lock until the end of the enclosing block (when
+// built with TODO_LOCKING_MUTEX). Nested holds by the same thread are fine.
+#if TODO_LOCKING == TODO_LOCKING_MUTEX
+#define LIST_LOCK(list) \
+    TaskList* heldList __attribute__((cleanup(listUnlock))) = listLock(list)
+#else
+#define LIST_LOCK(list) (void)(list)
+#endif
+
+// Async jobs are coroutines in the style of protothreads: the job's
+// step function is one switch statement, and each wait point is a case
+// label that the next call jumps back to. So:
+//   - Start the step function with ASYNC_BEGIN() and end it with ASYNC_END().
+//   - Locals don't survive a wait; keep state in the job's struct.
+//   - At most one wait per source line (the line number is the label).
+//   - Don't wait inside a nested switch.
+#define ASYNC_PENDING 0 // Step function result: call me again later
+#define ASYNC_DONE 1    // Step function result: finished; free the job
+#define ASYNC_BEGIN(job) switch ((job)->resumeAt) { case 0:
+#define ASYNC_END(job) } (job)->resumeAt = -1; return ASYNC_DONE
+#define ASYNC_RETURN(job) do { (job)->resumeAt = -1; return ASYNC_DONE; } while (0)
+// Wait until 'condition' holds (checked each time the loop comes round).
+#define ASYNC_AWAIT(job, condition)                                        \
+    do {                                                                    \
+        (job)->resumeAt = __LINE__;                                         \
+        __attribute__((fallthrough));                                       \
+    case __LINE__:                                                          \
+        if (!(condition)) {                                                 \
+            return ASYNC_PENDING;                                           \
+        }                                                                   \
+    } while (0)
+// Let the rest of the event loop run, and carry on next time round.
+#define ASYNC_YIELD(job)                                                   \
+    do {                                                                    \
+        (job)->resumeAt = __LINE__;                                         \
+        return ASYNC_PENDING;                                               \
+    case __LINE__:;                                                         \
+    } while (0)
+// Run 'function(arg)' on the worker thread and wait for it; the result
+// is then in (job)->callResult, and errno in (job)->callErrno.
+#define ASYNC_CALL(job, function, arg)                                     \
+    do {                                                                    \
+        executorSubmit((job), (function), (arg));                           \
+        ASYNC_AWAIT((job), !(job)->waiting);                                \
+    } while (0)
+
+// Times the rest of the enclosing block into the histogram for 'op'.
+// Operations called from inside another timed one (addTask() from
+// loadTasks(), say) count only towards the outer one.
+#define LATENCY_SCOPE(op) \
+    LatencyScope latencyScope __attribute__((cleanup(latencyStop))) = latencyStart(op)
+
+// Records the rest of the enclosing block as a span named 'name' (a
+// string literal) in this thread's trace ring, when --trace is on.
+#define TRACE_SPAN(name) \
+    TraceSpan traceSpan __attribute__((cleanup(traceEnd))) = traceBegin(name)
 
 // --- Data Structure ---
 
 // Define a Task structure
 // This is the blueprint for each to-do item
 typedef struct Task {
+#if TODO_DESCRIPTION == TODO_DESCRIPTION_INLINE
     char description[MAX_TASK_LEN]; // The text of the task
+#endif
     int completed;                  // 0 = incomplete, 1 = complete
+    unsigned long id;               // Stable ID, shared by every version of the task
+    unsigned long beginVersion;     // Version that created this record
+    unsigned long endVersion;       // Version that replaced/deleted it (VERSION_INFINITY if current)
     struct Task *next;              // Pointer to the next task in the list
+#if TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT
+    char description[];             // The text of the task, sized to fit
+#endif
 } Task;
 
+// A description that isn't owned: 'length' bytes at 'text', not
+// necessarily NUL-terminated (e.g. part of a line read from the file).
+// createTaskView() copies it into the new task, the one copy it gets.
+typedef struct TextView {
+    const char* text;
+    size_t length;
+} TextView;
+
+// The kinds of change a subscriber is told about.
+typedef enum ChangeType {
+    CHANGE_ADD,
+    CHANGE_MARK,
+    CHANGE_DELETE
+} ChangeType;
+
+// One change, as delivered to subscribers. 'index' is the task's 1-based
+// position at the moment of the change, so applying the events in order
+// to a copy of the list keeps that copy identical to this one.
+typedef struct ChangeEvent {
+    unsigned long sequence;          // Version the change committed at
+    ChangeType type;
+    int index;                       // Position of the task when it changed
+    unsigned long id;                // The task's stable ID
+    char description[MAX_TASK_LEN];  // The new task's text (CHANGE_ADD only)
+} ChangeEvent;
+
+// A bounded queue of changes for one subscriber. The writer never waits
+// for a slow reader: once the ring is full, further changes are dropped
+// and 'overflowed' is set, and the reader has to start over.
+typedef struct Subscriber {
+    struct TaskList* list;           // The list being watched
+    ChangeEvent events[SUBSCRIBER_RING_SIZE];
+    unsigned long head;              // Count of events read
+    unsigned long tail;              // Count of events written
+    int overflowed;                  // Changes were dropped
+    struct Subscriber* next;         // Next subscriber of the same list
+} Subscriber;
+
+// What one line of the task file held when we last loaded or saved it.
+// Comparing these against the file tells us which lines another program
+// appended or changed, so only those have to be parsed again.
+typedef struct LineRecord {
+    off_t offset;                    // Where the line starts in the file
+    size_t length;                   // Bytes in the line, not counting '\n'
+    unsigned long hash;              // hashLine() of those bytes
+    unsigned long id;                // Task made from the line (0 = didn't parse)
+} LineRecord;
+
+// The list itself, plus the bookkeeping needed for multi-version reads.
+// Every write (add, mark, delete) gets a new version number. Instead of
+// changing a record in place while a reader might be walking the list,
+// the writer stamps the old record with an 'endVersion' and (for a mark)
+// links a new record carrying the new state right after it. A reader that
+// opened a snapshot at version V only looks at records that were alive
+// at V, so it always sees one consistent point-in-time list.
+typedef struct TaskList {
+    Task* head;                  // First record in the list (NULL if empty)
+    Task* tail;                  // Last record, so appends don't walk the list
+    unsigned long version;       // Last committed version
+    unsigned long* snapshots;    // Versions pinned by open snapshots (VERSION_INFINITY = free slot)
+    int snapshotCount;           // Number of open snapshots
+    int snapshotCapacity;        // Number of slots in 'snapshots'
+    int garbage;                 // Dead records waiting for collectGarbage()
+    int count;                   // Number of live tasks
+    int done;                    // ...of which marked complete
+    unsigned long nextId;        // ID to give the next new task
+    Subscriber* subscribers;     // Who to tell about changes
+    LineRecord* lines;           // The task file's lines as of the last load/save
+    int lineCount;
+    int lineCapacity;
+    off_t fileSize;              // Bytes of the task file covered by 'lines'
+    struct timespec fileTime;    // The file's modification time at that point
+    char file[LIST_NAME_MAX + 8]; // The task file (FILENAME, or "NAME.txt" in a workspace)
+    unsigned long savedVersion;  // Version the file last matched
+    int pins;                    // Async jobs using the list; it mustn't be freed
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    Task** positions;            // Live tasks in order: positions[i] is task i + 1
+    int positionCapacity;
+#endif
+#if TODO_LOCKING == TODO_LOCKING_MUTEX
+    pthread_mutex_t lock;        // Held by every list operation (recursive)
+#endif
+} TaskList;
+
+// A reader's handle on a point-in-time view of a TaskList.
+typedef struct Snapshot {
+    TaskList* list;              // The list this snapshot reads from
+    unsigned long version;       // Records alive at this version are visible
+    int slot;                    // Index into list->snapshots
+} Snapshot;
+
+// One HTTP connection. Buffers are fixed-size, so serving a request
+// never allocates; a listing that doesn't fit is streamed in chunks
+// from 'cursor', reading through 'snapshot'. A subscribed connection
+// then keeps streaming events from 'subscriber'.
+typedef struct HttpClient {
+    int fd;                          // Socket (-1 = unused slot)
+    int keepAlive;                   // Keep the connection after this response
+    char in[HTTP_BUFFER_SIZE + 1];   // Received, not yet handled bytes (+ NUL)
+    size_t inLen;
+    char out[HTTP_BUFFER_SIZE];      // Response bytes waiting to be sent
+    size_t outLen;
+    size_t outSent;
+    int streaming;                   // A task array is being streamed
+    Snapshot snapshot;               // The view the stream reads from
+    Task* cursor;                    // Next record to encode
+    int index;                       // Position of 'cursor'
+    int matches;                     // Tasks encoded so far
+    char query[MAX_TASK_LEN];        // Search text ("" = every task)
+    Subscriber* subscriber;          // Set while streaming change events
+    int queued;                      // Complete requests waiting in 'in', to be run
+    int refused;                     // Complete requests after those, to get a 503
+    long long queuedSince;           // When the oldest queued request arrived
+    struct Job* job;                 // Async job that will write the response
+    int forwarded;                   // Another shard owes this connection a response
+    unsigned long generation;        // Tells apart connections that reuse this slot
+} HttpClient;
+
+// A unit of async work: a coroutine (see ASYNC_BEGIN) run by an Executor.
+// Specific jobs put this first in their own struct.
+typedef struct Job {
+    int (*step)(struct Job* job);    // Runs the job until it waits or finishes
+    int resumeAt;                    // Where 'step' picks up (0 = the start)
+    int waiting;                     // Parked on a call to the worker thread
+    int (*call)(void* arg);          // That call...
+    void* callArg;
+    int callResult;                  // ...and what it returned
+    int callErrno;
+    HttpClient* client;              // Connection waiting for the result (NULL if gone)
+    struct Executor* executor;
+    struct Job* next;                // Next job the executor is running
+    struct Job* nextCall;            // Next job in the worker's queue
+} Job;
+
+// Runs jobs from the event loop, and their blocking calls on a worker
+// thread. The thread only ever touches a job while it is parked.
+typedef struct Executor {
+    int eventFd;                     // Readable when calls have finished (-1 = not started)
+    pthread_t worker;
+    pthread_mutex_t lock;            // Guards 'submitted', 'finished' and 'stopping'
+    pthread_cond_t wake;
+    int stopping;
+    Job* submitted;                  // Calls waiting for the worker
+    Job* finished;                   // Calls done, jobs not yet resumed
+    Job* jobs;                       // Every unfinished job
+    Job* saving;                     // The save in progress, if any
+    unsigned long spawned;           // Jobs started
+    unsigned long completed;         // Jobs finished
+} Executor;
+
+// An async save (see saveJobStep).
+typedef struct SaveJob {
+    Job base;
+    TaskList* list;
+    Snapshot snapshot;               // The version being saved
+    Task* cursor;                    // Next record to format
+    char* data;                      // The formatted file
+    size_t length;
+    size_t capacity;
+    LineRecord* lines;               // Line index for the new file
+    int lineCount;
+    int lineCapacity;
+    char path[LIST_NAME_MAX + 16];   // Temporary file, renamed over the list's file
+    int fd;
+} SaveJob;
+
+// One load-generator connection and its response parser state.
+typedef struct BenchConnection {
+    int fd;
+    long long sentAt;                // When the in-flight request was sent
+    char header[1024];               // Response header being collected
+    size_t headerLen;
+    int headerDone;
+    int chunked;                     // Body uses chunked encoding
+    long remaining;                  // Content-Length bytes left
+    char tail[6];                    // Last bytes of a chunked body
+} BenchConnection;
+
+// Which side of replication this process is on.
+typedef enum ReplicationRole {
+    ROLE_STANDALONE,                 // No replication
+    ROLE_LEADER,                     // Accepts writes and feeds followers
+    ROLE_FOLLOWER                    // Mirrors a leader and serves reads
+} ReplicationRole;
+
+// The leader's view of one connected follower.
+typedef struct Follower {
+    int fd;                          // Unix socket (-1 = unused slot)
+    Subscriber* subscriber;          // Changes committed since its snapshot
+    Snapshot snapshot;               // The snapshot being sent
+    int sendingSnapshot;             // Still sending 'snapshot'
+    Task* cursor;                    // Next snapshot record to send
+    char out[REPL_BUFFER_SIZE];      // Lines waiting to be sent
+    size_t outLen;
+    size_t outSent;
+    unsigned long sentVersion;       // Newest leader version put in 'out'
+    int snapshotsSent;               // 1, plus one per catch-up
+} Follower;
+
+// Replication state for either role.
+typedef struct Replication {
+    ReplicationRole role;
+    const char* path;                // Unix socket path
+    int fd;                          // Leader: listening socket; follower: leader connection
+    Follower followers[REPL_MAX_FOLLOWERS]; // Leader only
+    long long lastHeartbeat;         // Leader: when heartbeats were last queued
+    char in[REPL_BUFFER_SIZE + 1];   // Follower: unparsed bytes from the leader (+ NUL)
+    size_t inLen;
+    unsigned long appliedVersion;    // Follower: leader version applied so far
+    unsigned long leaderVersion;     // Follower: newest leader version heard of
+    long long lagNanos;              // Follower: how old the last heartbeat was on arrival
+    long long lastMessageAt;         // Follower: when the leader last said anything
+    long long lastConnectAttempt;    // Follower: for retrying a lost leader
+    int snapshotsLoaded;             // Follower: full snapshots applied
+} Replication;
+
+// One named list in a workspace, loaded or not.
+typedef struct ListEntry {
+    char name[LIST_NAME_MAX];        // e.g. "groceries" (file: groceries.txt)
+    TaskList* list;                  // NULL while not loaded
+    int pinned;                      // Never evicted (the server's own list)
+    long long lastUsed;              // For least-recently-used eviction
+    size_t bytes;                    // Memory it was using when last measured
+    int changed;                     // Its file changed on disk
+    struct ListEntry* next;
+} ListEntry;
+
+// The lists in the working directory that have been asked for.
+typedef struct Workspace {
+    ListEntry* entries;
+    ListEntry* mainEntry;            // "tasks": the server's own list
+    size_t budget;                   // Bytes loaded lists may use in all
+    size_t loadedBytes;
+    int loadedCount;                 // Loaded lists, not counting the main one
+    unsigned long loads;             // Lists read from disk
+    unsigned long evictions;         // Lists saved and dropped to stay in budget
+} Workspace;
+
+// How far along handing the server to a new process is.
+typedef enum HandoffPhase {
+    HANDOFF_NONE,                    // Serving normally
+    HANDOFF_STARTING,                // List frozen; waiting for the new process
+    HANDOFF_DRAINING                 // New process serving; passing it connections
+} HandoffPhase;
+
+// The kinds of message sent over the handoff socket.
+typedef enum HandoffKind {
+    HANDOFF_STATE,                   // Old -> new: state memfd and listening sockets
+    HANDOFF_READY,                   // New -> old: now accepting connections
+    HANDOFF_CLIENT                   // Old -> new: one connection, plus its buffered bytes
+} HandoffKind;
+
+// Header of a handoff message. A HANDOFF_CLIENT message is followed by
+// 'inLen' bytes of unhandled request data and 'outLen' bytes of unsent
+// response data.
+typedef struct HandoffMessage {
+    HandoffKind kind;
+    int keepAlive;
+    size_t inLen;
+    size_t outLen;
+} HandoffMessage;
+
+// Start of the state file a restarting server hands over.
+typedef struct HandoffHeader {
+    char magic[8];                   // HANDOFF_MAGIC
+    unsigned long version;           // The list's version
+    unsigned long nextId;            // ID for the next new task
+    int taskCount;                   // HandoffTasks that follow
+    int lineCount;                   // LineRecords after those
+    off_t fileSize;                  // Task file bookkeeping, as in TaskList
+    struct timespec fileTime;
+} HandoffHeader;
+
+// One task in the state file.
+typedef struct HandoffTask {
+    unsigned long id;
+    int completed;
+    char description[MAX_TASK_LEN];
+} HandoffTask;
+
+// Everything one server process juggles in its poll() loop.
+typedef struct Server {
+    TaskList* list;                  // The list being served
+    int listener;                    // HTTP listening socket (-1 once handed off)
+    int watchFd;                     // inotify on tasks.txt (-1 = not watching)
+    HttpClient clients[HTTP_MAX_CLIENTS];
+    Replication replication;
+    HandoffPhase handoffPhase;
+    int handoffFd;                   // Socket to the next (or previous) process, or -1
+    pid_t successor;                 // The process being handed off to
+    int connections;                 // Open HTTP connections
+    int queuedRequests;              // Complete requests waiting, all connections
+    int peakQueued;                  // Most ever waiting at once
+    int readsPaused;                 // Too much queued; not reading any socket
+    unsigned long handledRequests;   // Requests run
+    unsigned long shedRequests;      // Requests refused with 503 (waited too long)
+    unsigned long shedConnections;   // Connections refused with 503 (server full)
+    unsigned long pausedTurns;       // Loop turns spent with reads paused
+    Executor executor;               // Runs async jobs, e.g. POST /save
+    Workspace workspace;             // Other lists, under /lists/NAME/
+    struct Shard* shard;             // This loop's shard with --threads (NULL = the only loop)
+    unsigned long generations;       // Last HttpClient generation handed out
+} Server;
+
+// Lock-free queue between exactly two threads: one producer, one
+// consumer. 'head' and 'tail' only ever grow; each is written by one side
+// and sits on its own cache line so the two don't fight over it.
+typedef struct ShardQueue {
+    _Atomic unsigned long head __attribute__((aligned(64))); // Next slot to read (consumer's)
+    _Atomic unsigned long tail __attribute__((aligned(64))); // Next slot to write (producer's)
+    size_t slotSize __attribute__((aligned(64)));
+    unsigned long slotCount;         // A power of two
+    char* slots;
+} ShardQueue;
+
+// A request one shard passes to the shard that owns its list.
+typedef struct ShardRequest {
+    int slot;                        // Requesting connection's index in clients[]
+    unsigned long generation;        // ...and its generation, in case it closes meanwhile
+    int keepAlive;
+    char method[8];
+    char list[LIST_NAME_MAX];        // The owned list's name
+    char path[HTTP_MAX_PATH];        // Request target, less any /lists/NAME prefix
+    char body[HTTP_MAX_BODY + 1];
+} ShardRequest;
+
+// A piece of the response, on its way back. Big responses (streamed
+// listings) take several.
+typedef struct ShardResponse {
+    int slot;
+    unsigned long generation;
+    int last;                        // The response is complete
+    size_t length;
+    char data[HTTP_BUFFER_SIZE];     // Bytes for the connection, as-is
+} ShardResponse;
+
+// A shard's side of the requests another shard sends it.
+typedef struct ShardPeer {
+    HttpClient scratch;              // Runs the peer's request; 'out' is the response
+    int busy;                        // 'scratch' has response bytes still to send back
+    int slot;                        // Who they're for
+    unsigned long generation;
+} ShardPeer;
+
+// One thread of a --threads server: a core, its own event loop and
+// listening socket, and the lists that hash to it.
+typedef struct Shard {
+    int index;
+    int cpu;                         // Core the thread is pinned to
+    pthread_t thread;
+    int eventFd;                     // Written by peers that queued something for us
+    Server* server;                  // This shard's loop (allocated on its own thread)
+    ShardPeer* peers;                // Indexed by the sending shard
+    struct ShardGroup* group;
+    unsigned long forwardedRequests; // Sent to other shards
+    unsigned long servedRequests;    // Run for other shards
+} __attribute__((aligned(64))) Shard;
+
+// All the shards of a --threads server.
+typedef struct ShardGroup {
+    int count;
+    Shard* shards;
+    ShardQueue** requests;           // [from * count + to], made by 'to'
+    ShardQueue** responses;          // [from * count + to], made by 'to'
+    TaskList* mainList;              // "tasks", served by its owner shard
+    const struct Options* options;
+    pthread_barrier_t started;       // Every shard's queues exist
+    pthread_barrier_t stopped;       // Nobody touches the queues any more
+    _Atomic int failed;              // A shard couldn't start; everyone stops
+} ShardGroup;
+
+// One finished span: a Chrome trace "complete" event.
+typedef struct TraceEvent {
+    const char* name;                // A string literal
+    long long start;                 // nowNanos()
+    long long duration;              // Nanoseconds
+} TraceEvent;
+
+// A thread's recent spans. The owning thread is the only writer; the
+// export reads 'next' to see how far it has got.
+typedef struct TraceRing {
+    TraceEvent events[TRACE_RING_SIZE];
+    _Atomic unsigned long next;      // Spans ever recorded; slot = next % size
+    int tid;                         // Kernel thread ID, for the viewer
+    struct TraceRing* nextRing;      // All rings, for the export
+} TraceRing;
+
+// A span in progress (see TRACE_SPAN).
+typedef struct TraceSpan {
+    const char* name;
+    long long started;               // 0 when not tracing
+} TraceSpan;
+
+// Hardware performance counters (perf_event_open) around a benchmark.
+// A counter the kernel or CPU won't give us has fd -1 and is left out.
+typedef struct PerfCounters {
+    int fds[PERF_COUNTERS];
+    unsigned long long values[PERF_COUNTERS]; // Counted by the last start/stop
+    unsigned long long copied;                // Description bytes copied, same span
+} PerfCounters;
+
+// Counts kept by createTask() and destroyTask(), for the memory report.
+typedef struct MemoryStats {
+    unsigned long tasksCreated;
+    unsigned long tasksDestroyed;
+    unsigned long long descriptionBytes; // Live descriptions' bytes, NUL included
+    unsigned long long bytesCopied;      // Description bytes copied into tasks, ever
+} MemoryStats;
+
+// The operations whose latency is tracked.
+typedef enum LatencyOp {
+    LATENCY_ADD,
+    LATENCY_LIST,
+    LATENCY_MARK,
+    LATENCY_DELETE,
+    LATENCY_LOAD,
+    LATENCY_SAVE,
+    LATENCY_OPS                      // How many there are
+} LatencyOp;
+
+// Log-linear latency histogram, in the style of HdrHistogram: buckets
+// are exact below 2 * LATENCY_HALF ns, then LATENCY_HALF buckets per
+// power of two, so any value is off by at most 1/LATENCY_HALF (about 6%).
+// Recording is a few instructions and never allocates.
+typedef struct LatencyHistogram {
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long count;
+    long long sum;                   // Nanoseconds, for the mean
+    long long max;
+} LatencyHistogram;
+
+// One timed operation in progress (see LATENCY_SCOPE).
+typedef struct LatencyScope {
+    LatencyOp op;
+    long long started;               // nowNanos(), or 0 if nested in another
+} LatencyScope;
+
+// Where loading a task file spends its time (see loadTasks()).
+typedef enum LoadPhase {
+    LOAD_OPEN,
+    LOAD_READ,
+    LOAD_PARSE,
+    LOAD_CREATE,                     // createTask()
+    LOAD_LINK,                       // linkTask()
+    LOAD_INDEX,                      // indexLine()
+    LOAD_PHASES                      // How many there are
+} LoadPhase;
+
+// The counters in the metrics registry. The first LATENCY_OPS line up
+// with LatencyOp.
+typedef enum Metric {
+    METRIC_OP_ADD,
+    METRIC_OP_LIST,
+    METRIC_OP_MARK,
+    METRIC_OP_DELETE,
+    METRIC_OP_LOAD,
+    METRIC_OP_SAVE,
+    METRIC_HTTP_HANDLED,             // Requests run
+    METRIC_HTTP_SHED,                // Requests refused with 503
+    METRIC_BYTES_READ,               // Task file bytes read
+    METRIC_BYTES_WRITTEN,            // Task file bytes written
+    METRIC_LIST_HITS,                // Workspace lists already in memory
+    METRIC_LIST_MISSES,              // ...and loaded from disk
+    METRIC_LINES_REUSED,             // File sync: lines unchanged since the last load/save
+    METRIC_LINES_PARSED,             // ...and lines parsed again
+    METRICS                          // How many there are
+} Metric;
+
+// How a registry counter is shown on the metrics page.
+typedef struct MetricInfo {
+    const char* family;              // Prometheus metric name
+    const char* labels;              // e.g. "op=\"add\"" ("" = none)
+    const char* help;
+} MetricInfo;
+
+// One thread's registry counters. Only the owning thread writes them;
+// the metrics page adds up every thread's block.
+typedef struct MetricBlock {
+    unsigned long counts[METRICS];
+    struct MetricBlock* nextBlock;   // All blocks, for the page
+} __attribute__((aligned(64))) MetricBlock;
+
+// The metrics page being written (see metricsPut()).
+typedef struct MetricsPage {
+    char* out;
+    size_t room;
+    size_t used;
+    const char* family;              // Last family written; its HELP/TYPE is out
+} MetricsPage;
+
+// Where task records and the list's indexes get their memory (see
+// "Memory Resources"). One is in use per run, picked with --allocator.
+typedef struct MemoryResource {
+    const char* name;
+    void* (*allocate)(struct MemoryResource* resource, size_t size);
+    void (*release)(struct MemoryResource* resource, void* block, size_t size);
+    void* (*resize)(struct MemoryResource* resource, void* block, size_t oldSize,
+                    size_t newSize);
+    size_t slabSize;                 // Pools: bytes carved into blocks at a time
+    int hugePages;                   // Pools: slabs are huge pages
+    pthread_mutex_t lock;            // Guards the rest (not taken by "malloc")
+    char* free;                      // Monotonic, pools: next unused byte of the chunk or slab
+    size_t left;                     // ...and how many follow it
+    void* freeBlocks[POOL_CLASSES];  // Pools: released blocks of each size, linked through them
+    unsigned long long reserved;     // Bytes it holds: chunks, slabs and big blocks
+    unsigned long long inUse;        // Bytes handed out and not released
+} MemoryResource;
+
+// What the command line asked for.
+typedef struct Options {
+    int servePort;                   // --serve PORT (0 = interactive menu)
+    const char* replicatePath;       // --replicate PATH: lead followers on this socket
+    const char* followPath;          // --follow PATH: mirror the leader on this socket
+    int benchPort;                   // --bench-http PORT [CONNECTIONS] [REQUESTS]
+    int benchConnections;
+    long benchRequests;
+    int takeoverFd;                  // --takeover FD: continue a restarting server (-1 = no)
+    const char* workspaceDir;        // --workspace DIR: keep the lists here
+    long memoryBudgetMB;             // --memory-budget MB: for loaded lists
+    int threads;                     // --threads N: shards, one pinned thread each (0 = one loop)
+    const char* benchPath;           // --bench-path PATH: what --bench-http GETs
+    long benchTasks;                 // --bench [MAX]: time the list operations up to MAX tasks
+    int benchCounters;               // --counters: also read hardware counters in --bench
+    const char* tracePath;           // --trace FILE: record spans, written here on demand/exit
+    const char* allocator;           // --allocator NAME: memory resource for tasks and indexes
+    int profileStartup;              // --profile-startup: time startup, stop at the menu
+    long benchStartupTasks;          // --bench-startup [MAX]: time cold and warm starts up to MAX
+    const char* generateTasksPath;   // --generate-tasks FILE COUNT: write a task file
+    const char* generateOpsPath;     // --generate-ops FILE COUNT: write an operation stream
+    long generateCount;              // ...with this many tasks or operations
+    unsigned long long seed;         // --seed N: for the generators
+    int completedPercent;            // --completed PCT: done share of generated tasks
+    long startTasks;                 // --start-tasks N: list size the op stream starts from
+    const char* batchPath;           // --batch FILE: run an operation stream ("-" = stdin)
+    const char* recordPath;          // --record FILE: log menu commands as a trace
+    const char* replayPath;          // --replay FILE: run a trace, timing each command
+    int argc;                        // The command line, to re-run it on restart
+    char** argv;
+} Options;
+
 // --- Function Prototypes ---
 
 // Core Linked List Functions
+void initList(TaskList* list);
+void setListFile(TaskList* list, const char* file);
+TextView textView(const char* text);
+TextView firstLineView(const char* text);
 Task* createTask(const char* description);
-void addTask(Task** head, const char* description);
-void deleteTask(Task** head, int index);
-void freeList(Task* head);
+Task* createTaskView(TextView description);
+void destroyTask(Task* task);
+void addTask(TaskList* list, const char* description);
+void addTaskView(TaskList* list, TextView description);
+void linkTask(TaskList* list, Task* newTask);
+size_t taskRecordSize(void);
+const char* buildPolicies(void);
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+void positionsInsert(TaskList* list, int index, Task* task);
+void positionsRemove(TaskList* list, int index);
+void positionsReserve(TaskList* list, int count);
+#endif
+#if TODO_LOCKING == TODO_LOCKING_MUTEX
+TaskList* listLock(TaskList* list);
+void listUnlock(TaskList** held);
+#endif
+void insertTask(TaskList* list, int index, const char* description);
+void insertTaskView(TaskList* list, int index, TextView description);
+void linkTaskAt(TaskList* list, int index, Task* newTask);
+void linkTaskAfter(TaskList* list, Task* previous, int index, Task* newTask);
+int completeTask(TaskList* list, int index);
+int removeTask(TaskList* list, int index);
+void freeList(TaskList* list);
+
+// Batch Functions
+Task* addTasks(TaskList* list, const TextView* descriptions, int count);
+int completeTasks(TaskList* list, const int* indices, int count);
+int removeTasks(TaskList* list, const int* indices, int count);
+int sortBatchIndices(const TaskList* list, const int* indices, int count, int** sorted);
+int compareIndices(const void* a, const void* b);
+int compareIds(const void* a, const void* b);
+int appendTasks(TaskList* list, Task* first);
+
+// Versioning (MVCC) Functions
+Snapshot openSnapshot(TaskList* list);
+void closeSnapshot(Snapshot* snapshot);
+int isVisible(const Task* task, unsigned long version);
+Task* firstVisible(Task* task, unsigned long version);
+Task* findTask(TaskList* list, int index, Task** previous);
+int findTaskIndexById(TaskList* list, unsigned long id);
+void collectGarbage(TaskList* list);
+
+// Change Notification Functions
+Subscriber* subscribe(TaskList* list);
+void unsubscribe(Subscriber* subscriber);
+void publishChange(TaskList* list, ChangeType type, int index, const Task* task);
+ChangeEvent* peekChange(Subscriber* subscriber);
+void consumeChange(Subscriber* subscriber);
 
 // Application-Specific Functions
-void displayTasks(Task* head);
-void markComplete(Task* head, int index);
-void saveTasks(Task* head);
-void loadTasks(Task** head);
+void displayTasks(TaskList* list);
+void markComplete(TaskList* list, int index);
+void deleteTask(TaskList* list, int index);
+void searchTasks(TaskList* list, const char* query);
+void saveTasks(TaskList* list);
+int writeTasks(TaskList* list);
+void loadTasks(TaskList* list);
+int readTasks(TaskList* list);
+int parseTaskLine(const char* line, int* completed, TextView* description);
 void printMenu(void);
 void clearInputBuffer(void);
+int parseOptions(int argc, char* argv[], Options* options);
+
+// File Watching Functions
+int watchTasksFile(void);
+int reloadChangedTasks(TaskList* list, int watchFd);
+int syncTasksFile(TaskList* list);
+int loadAppendedLines(TaskList* list, FILE* file);
+int reloadChangedLines(TaskList* list, FILE* file);
+void indexLine(TaskList* list, off_t offset, const char* line, size_t length, unsigned long id);
+void recordFileState(TaskList* list, off_t size);
+unsigned long hashLine(const char* text, size_t length);
+
+// HTTP Server Functions
+int runServer(TaskList* list, const Options* options);
+int runHttpBench(int port, int connections, long requests, const char* path);
+void httpReset(HttpClient* client);
+void httpCloseClient(Server* server, HttpClient* client);
+int httpPump(HttpClient* client, Server* server);
+int httpHandleRequest(HttpClient* client, Server* server);
+void httpDispatch(HttpClient* client, Server* server,
+                  const char* method, char* path, char* body);
+void httpDispatchList(HttpClient* client, Server* server, TaskList* list,
+                      const char* method, char* path, char* body);
+void httpRespond(HttpClient* client, const char* status, const char* body);
+void httpRespondAs(HttpClient* client, const char* status, const char* type, const char* body);
+int httpCountRequests(const char* in, size_t length);
+void httpShedConnection(Server* server, int fd);
+void httpAdmitRequests(Server* server, HttpClient* client);
+void httpAcceptClients(Server* server);
+short httpClientEvents(const Server* server, const HttpClient* client, int frozen);
+void httpServiceClient(Server* server, HttpClient* client, short revents);
+void describeAdmission(Server* server, char* out, size_t room);
+void httpStartListing(HttpClient* client, TaskList* list, const char* query);
+void httpContinueListing(HttpClient* client);
+void httpStartSubscription(HttpClient* client, TaskList* list);
+void httpContinueEvents(HttpClient* client);
+size_t httpBeginChunk(HttpClient* client);
+void httpEndChunk(HttpClient* client, size_t length, int last);
+size_t jsonPutString(char* out, size_t room, const char* text);
+size_t jsonPutTask(char* out, size_t room, const char* type, int index, const Task* task);
+size_t jsonPutChange(char* out, size_t room, const ChangeEvent* event);
+int openListener(int port, int shared);
+void urlDecode(char* text);
+long long nowNanos(void);
+int compareLongLong(const void* a, const void* b);
+int benchConsume(BenchConnection* conn, const char* data, size_t length);
+
+// Replication Functions
+int openReplicationListener(const char* path);
+int connectToLeader(Replication* replication);
+void startFollowerSnapshot(Follower* follower, TaskList* list);
+void fillFollower(Follower* follower, TaskList* list);
+int flushFollower(Follower* follower);
+int followerHasOutput(Follower* follower);
+void dropFollower(Follower* follower);
+void sendHeartbeats(Replication* replication, TaskList* list);
+void applyReplicationLine(Replication* replication, TaskList* list, char* line);
+void readFromLeader(Replication* replication, TaskList* list);
+void describeReplication(Replication* replication, TaskList* list, char* out, size_t room);
+
+// Restart (Handoff) Functions
+int sendHandoff(int sock, const HandoffMessage* message, const char* in, const char* out,
+                const int* fds, int count);
+int receiveHandoff(int sock, HandoffMessage* message, char* payload, int* fds, int* count,
+                   int flags);
+int writeHandoffState(TaskList* list);
+int readHandoffState(TaskList* list, int fd);
+int startHandoff(Server* server, const Options* options);
+int takeOverServer(Server* server, int sock, int* replicationFd);
+void serviceHandoff(Server* server);
+int handOffClients(Server* server);
+
+// Workspace Functions
+int validListName(const char* name);
+size_t listMemory(const TaskList* list);
+int listInUse(const TaskList* list);
+void workspaceInit(Workspace* workspace, TaskList* mainList, size_t budget);
+ListEntry* workspaceFind(Workspace* workspace, const char* name, int create);
+TaskList* workspaceOpen(Workspace* workspace, const char* name);
+void workspaceTouch(Workspace* workspace, ListEntry* entry);
+void workspaceEvict(Workspace* workspace, ListEntry* entry);
+void workspaceEnforceBudget(Workspace* workspace);
+void workspaceSaveAll(Workspace* workspace);
+void workspaceClose(Workspace* workspace);
+void workspaceReloadChanged(Workspace* workspace, int watchFd);
+void describeWorkspace(Workspace* workspace, char* out, size_t room);
+
+// List Benchmark Functions
+int runListBench(long maxTasks, int useCounters);
+void benchListSize(long tasks, PerfCounters* counters);
+void benchBatches(long tasks, long indexed, PerfCounters* counters);
+void benchReport(const char* op, long tasks, long ops, long long nanos,
+                 const PerfCounters* counters);
+long long benchStart(PerfCounters* counters);
+long long benchStop(PerfCounters* counters, long long start);
+int perfCountersOpen(PerfCounters* counters);
+void perfCountersClose(PerfCounters* counters);
+int quietStdout(void);
+void restoreStdout(int saved);
+void resetPeakRss(void);
+long peakRssKb(void);
+
+// Workload Functions
+unsigned long long nextRandom(unsigned long long* state);
+void randomDescription(unsigned long long* state, char* out, size_t room);
+int generateTaskFile(const char* path, long count, unsigned long long seed, int completedPercent);
+int generateOpStream(const char* path, long count, unsigned long long seed, long startTasks);
+int runBatch(TaskList* list, const char* path, int timed);
+void recordCommand(FILE* trace, long long sessionStart, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Memory Report Functions
+void printMemoryReport(FILE* out, const TaskList* list);
+long currentRssKb(void);
+
+// Memory Resource Functions
+void* memoryAllocate(size_t size);
+void memoryRelease(void* block, size_t size);
+void* memoryResize(void* block, size_t oldSize, size_t newSize);
+MemoryResource* findMemoryResource(const char* name);
+void useMemoryResource(const char* name);
+void* mallocAllocate(MemoryResource* resource, size_t size);
+void mallocRelease(MemoryResource* resource, void* block, size_t size);
+void* mallocResize(MemoryResource* resource, void* block, size_t oldSize, size_t newSize);
+void* monotonicAllocate(MemoryResource* resource, size_t size);
+void monotonicRelease(MemoryResource* resource, void* block, size_t size);
+void* poolAllocate(MemoryResource* resource, size_t size);
+void poolRelease(MemoryResource* resource, void* block, size_t size);
+void* copyResize(MemoryResource* resource, void* block, size_t oldSize, size_t newSize);
+void* hugePageSlab(void);
+
+// Latency Histogram Functions
+LatencyScope latencyStart(LatencyOp op);
+void latencyStop(LatencyScope* scope);
+void latencyRecord(LatencyHistogram* histogram, long long nanos);
+int latencyBucket(unsigned long long nanos);
+long long latencyBucketValue(int bucket);
+long long latencyPercentile(const LatencyHistogram* histogram, double percentile);
+void printLatencyStats(FILE* out);
+void dumpLatencyStats(void);
+
+// Trace Functions
+void startTracing(const char* path);
+TraceSpan traceBegin(const char* name);
+void traceEnd(TraceSpan* span);
+void traceRecord(const char* name, long long start, long long duration);
+void tracePhase(long long* phase, long long* mark);
+long writeTrace(const char* path);
+void writeTraceAtExit(void);
+
+// Metrics Functions
+void metricAdd(Metric metric, unsigned long amount);
+unsigned long metricTotal(Metric metric);
+void metricsPut(MetricsPage* page, const char* family, const char* type, const char* help,
+                const char* labels, unsigned long long value);
+size_t writeMetrics(Server* server, char* out, size_t room);
+
+// Startup Profile Functions
+void startStartupProfile(void);
+long long loadProfileBegin(void);
+void loadProfileEnd(long long* phases, long long begun, long long opened, long long finished);
+void printStartupProfile(FILE* out, const TaskList* list, long long started,
+                         long long loadStarted, long long loadFinished, long long menuAt);
+int runStartupBench(long maxTasks);
+long long timeStartup(const char* exe);
+int evictFromCache(const char* path);
+int residentPercent(const char* path);
+
+// Sharded Server Functions
+int runShardedServer(TaskList* list, const Options* options);
+void* runShard(void* arg);
+int shardOf(const char* name, int count);
+ShardQueue* shardQueueCreate(size_t slotSize, unsigned long slotCount);
+void shardQueueFree(ShardQueue* queue);
+void* shardQueueReserve(ShardQueue* queue);
+void shardQueuePublish(ShardQueue* queue);
+void* shardQueuePeek(ShardQueue* queue);
+void shardQueuePop(ShardQueue* queue);
+void shardWake(Shard* shard);
+void httpForward(HttpClient* client, Server* server, const char* list,
+                 const char* method, const char* path, const char* body);
+void shardServePeer(Shard* shard, int from);
+void shardCollectResponses(Shard* shard, int from);
+void httpListLists(HttpClient* client, Workspace* workspace);
+
+// Async Job Functions
+int executorStart(Executor* executor);
+void executorStop(Executor* executor);
+void* executorWorker(void* arg);
+void executorSpawn(Executor* executor, Job* job);
+void executorSubmit(Job* job, int (*call)(void*), void* arg);
+int executorReady(Executor* executor);
+void executorRun(Executor* executor);
+void saveTasksAsync(Executor* executor, TaskList* list, HttpClient* client);
+int saveJobStep(Job* base);
+int saveJobWrite(void* arg);
+int saveJobSync(void* arg);
+void appendTaskLine(SaveJob* job, const Task* task);
+void finishSaveJob(SaveJob* job, const char* status, const char* body);
 
 // --- Main Function (The Program's Entry Point) ---
 
-int main() {
-    Task* head = NULL; // 'head' is a pointer to the first task in our list.
-                      // We start with an empty list (NULL).
+// libtodo is this file built with -DTODO_LIBRARY: everything but main().
+#ifndef TODO_LIBRARY
+int main(int argc, char* argv[]) {
+    TaskList list; // Holds the pointer to the first task in our list,
+                   // plus the version bookkeeping. We start empty.
+    int watchFd;   // Tells us when another program changes tasks.txt
+    Options options;
     int choice = 0;
     char inputBuffer[MAX_TASK_LEN];
     char taskDescription[MAX_TASK_LEN];
     int taskIndex;
+    FILE* trace = NULL; // --record: where each command is logged
+    long long sessionStart = nowNanos();
+    long long loadStarted;  // --profile-startup: when loading began...
+    long long loadFinished; // ...and ended
+
+    if (parseOptions(argc, argv, &options) != 0) {
+        return 1;
+    }
+    if (options.allocator != NULL) {
+        useMemoryResource(options.allocator); // Before anything is allocated
+    }
+    atexit(dumpLatencyStats); // Timings of whatever ran, on the way out
+    if (options.tracePath != NULL) {
+        startTracing(options.tracePath);
+    }
+    if (options.profileStartup) {
+        startStartupProfile();
+    }
+
+    // Load generator mode: drive a running server.
+    if (options.benchPort > 0) {
+        return runHttpBench(options.benchPort, options.benchConnections,
+                            options.benchRequests, options.benchPath);
+    }
+
+    // Benchmark mode: time the list operations, print the results, exit.
+    if (options.benchTasks > 0) {
+        return runListBench(options.benchTasks, options.benchCounters);
+    }
+    if (options.benchStartupTasks > 0) {
+        return runStartupBench(options.benchStartupTasks);
+    }
+
+    // Generator mode: write a synthetic task file or operation stream.
+    if (options.generateTasksPath != NULL) {
+        return generateTaskFile(options.generateTasksPath, options.generateCount,
+                                options.seed, options.completedPercent);
+    }
+    if (options.generateOpsPath != NULL) {
+        return generateOpStream(options.generateOpsPath, options.generateCount,
+                                options.seed, options.startTasks);
+    }
 
     printf("Welcome to your C To-Do List Manager!\n");
+    initList(&list);
+
+    // All the lists (tasks.txt and NAME.txt) live in the workspace directory.
+    if (options.workspaceDir != NULL) {
+        mkdir(options.workspaceDir, 0755); // Fine if it already exists.
+        if (chdir(options.workspaceDir) != 0) {
+            printf("Error: Could not open workspace %s (%s).\n",
+                   options.workspaceDir, strerror(errno));
+            return 1;
+        }
+    }
     
     // Load existing tasks from the file, if any.
-    // We pass '&head' (a pointer to our 'head' pointer) so the function
-    // can modify 'head' and build our linked list in memory.
-    loadTasks(&head);
+    // We pass '&list' so the function can modify the list's 'head'
+    // and build our linked list in memory.
+    // A follower gets its tasks from the leader instead, and a process
+    // taking over from a restarting server gets them from that server.
+    loadStarted = nowNanos();
+    if (options.followPath == NULL && options.takeoverFd < 0) {
+        loadTasks(&list);
+    }
+    loadFinished = nowNanos();
+
+    // Batch mode: run the commands in a file instead of showing the menu.
+    // Replay is the same, with each command timed.
+    if (options.batchPath != NULL || options.replayPath != NULL) {
+        int status = options.batchPath != NULL ? runBatch(&list, options.batchPath, 0)
+                                               : runBatch(&list, options.replayPath, 1);
+        freeList(&list);
+        return status;
+    }
+
+    // Server mode: serve over HTTP instead of showing the menu.
+    if (options.servePort > 0) {
+        int status = options.threads > 0 ? runShardedServer(&list, &options)
+                                         : runServer(&list, &options);
+        freeList(&list);
+        return status;
+    }
+
+    watchFd = watchTasksFile();
+
+    // Record mode: log every command, in the --batch format, for --replay.
+    if (options.recordPath != NULL) {
+        trace = fopen(options.recordPath, "w");
+        if (trace == NULL) {
+            printf("Error: Could not open file %s for writing.\n", options.recordPath);
+            return 1;
+        }
+        fprintf(trace, "# Session trace: seconds since start, then the command.\n");
+        fprintf(trace, "# Run it again with: todo --replay FILE\n");
+        fflush(trace);
+    }
+
+    // Startup profile mode: report how long it took to get here, and stop.
+    if (options.profileStartup) {
+        printStartupProfile(stderr, &list, sessionStart, loadStarted, loadFinished, nowNanos());
+        return 0;
+    }
 
     while (1) {
         printMenu();
@@ -74,6 +1158,10 @@ int main() {
             continue; // Handle input error
         }
 
+        // Pick up edits other programs made to tasks.txt before acting,
+        // so task numbers match what's in the file.
+        reloadChangedTasks(&list, watchFd);
+
         // sscanf parses the string from inputBuffer.
         // This is safer than scanf() as it avoids many input buffer issues.
         if (sscanf(inputBuffer, "%d", &choice) != 1) {
@@ -89,12 +1177,14 @@ int main() {
                 }
                 // Remove the newline character that fgets() stores
                 taskDescription[strcspn(taskDescription, "\n")] = 0;
-                addTask(&head, taskDescription);
+                recordCommand(trace, sessionStart, "add %s", taskDescription);
+                addTask(&list, taskDescription);
                 printf("Task added.\n");
                 break;
 
             case 2: // List Tasks
-                displayTasks(head);
+                recordCommand(trace, sessionStart, "list");
+                displayTasks(&list);
                 break;
 
             case 3: // Mark Complete
@@ -106,7 +1196,8 @@ int main() {
                     printf("Invalid number.\n");
                     break;
                 }
-                markComplete(head, taskIndex);
+                recordCommand(trace, sessionStart, "mark %d", taskIndex);
+                markComplete(&list, taskIndex);
                 break;
 
             case 4: // Delete Task
@@ -118,22 +1209,57 @@ int main() {
                     printf("Invalid number.\n");
                     break;
                 }
-                deleteTask(&head, taskIndex);
+                recordCommand(trace, sessionStart, "delete %d", taskIndex);
+                deleteTask(&list, taskIndex);
+                break;
+
+            case 5: // Search Tasks
+                printf("Enter text to search for: ");
+                if (fgets(taskDescription, sizeof(taskDescription), stdin) == NULL) {
+                    break;
+                }
+                taskDescription[strcspn(taskDescription, "\n")] = 0;
+                recordCommand(trace, sessionStart, "search %s", taskDescription);
+                searchTasks(&list, taskDescription);
                 break;
 
-            case 5: // Save and Quit
+            case 6: // Save and Quit
                 printf("Saving tasks and quitting...\n");
-                saveTasks(head); // Save all tasks to file
-                freeList(head);  // Free all allocated memory
+                recordCommand(trace, sessionStart, "save");
+                if (trace != NULL) {
+                    fclose(trace);
+                }
+                saveTasks(&list); // Save all tasks to file
+                freeList(&list);  // Free all allocated memory
+                if (watchFd >= 0) {
+                    close(watchFd);
+                }
                 return 0;        // Exit the program
 
+            case 7: // Timing Stats
+                printLatencyStats(stdout);
+                break;
+
+            case 8: // Memory Report
+                printMemoryReport(stdout, &list);
+                break;
+
+            case 9: // Trace Export
+                if (options.tracePath == NULL) {
+                    printf("Start with --trace FILE to record a trace.\n");
+                } else if (writeTrace(NULL) >= 0) {
+                    printf("Trace written to %s.\n", options.tracePath);
+                }
+                break;
+
             default:
-                printf("Invalid choice. Please select from 1-5.\n");
+                printf("Invalid choice. Please select from 1-9.\n");
         }
     }
 
     return 0; // Should never be reached
 }
+#endif
 
 // --- Function Definitions ---
 
@@ -148,6 +1274,123 @@ void clearInputBuffer(void) {
     while ((c = getchar()) != '\n' && c != EOF);
 }
 
+/**
+ * @brief Reads the command-line options.
+ * @param argc Number of arguments.
+ * @param argv The arguments.
+ * @param options Receives the options.
+ * @return 0 on success, -1 (after printing usage) on a bad command line.
+ */
+int parseOptions(int argc, char* argv[], Options* options) {
+    int i;
+
+    memset(options, 0, sizeof(*options));
+    options->benchConnections = 8;
+    options->benchRequests = 100000;
+    options->takeoverFd = -1;
+    options->memoryBudgetMB = DEFAULT_MEMORY_BUDGET_MB;
+    options->seed = DEFAULT_SEED;
+    options->completedPercent = DEFAULT_COMPLETED_PERCENT;
+    options->argc = argc;
+    options->argv = argv;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            options->servePort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replicate") == 0 && i + 1 < argc) {
+            options->replicatePath = argv[++i];
+        } else if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+            options->followPath = argv[++i];
+        } else if (strcmp(argv[i], "--workspace") == 0 && i + 1 < argc) {
+            options->workspaceDir = argv[++i];
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            options->memoryBudgetMB = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            options->benchTasks = BENCH_DEFAULT_MAX;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options->benchTasks = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--generate-tasks") == 0 && i + 2 < argc) {
+            options->generateTasksPath = argv[++i];
+            options->generateCount = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--generate-ops") == 0 && i + 2 < argc) {
+            options->generateOpsPath = argv[++i];
+            options->generateCount = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options->seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--completed") == 0 && i + 1 < argc) {
+            options->completedPercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--start-tasks") == 0 && i + 1 < argc) {
+            options->startTasks = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            options->batchPath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            options->recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            options->replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options->tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc) {
+            options->allocator = argv[++i];
+        } else if (strcmp(argv[i], "--profile-startup") == 0) {
+            options->profileStartup = 1;
+        } else if (strcmp(argv[i], "--bench-startup") == 0) {
+            options->benchStartupTasks = BENCH_STARTUP_DEFAULT_MAX;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options->benchStartupTasks = atol(argv[++i]);
+            }
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            options->benchCounters = 1;
+        } else if (strcmp(argv[i], "--bench-path") == 0 && i + 1 < argc) {
+            options->benchPath = argv[++i];
+        } else if (strcmp(argv[i], "--takeover") == 0 && i + 1 < argc) {
+            options->takeoverFd = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-http") == 0 && i + 1 < argc) {
+            options->benchPort = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options->benchConnections = atoi(argv[++i]);
+            }
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                options->benchRequests = atol(argv[++i]);
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (i < argc ||
+        ((options->replicatePath || options->followPath || options->takeoverFd >= 0) &&
+         options->servePort <= 0) ||
+        (options->replicatePath && options->followPath) ||
+        (options->generateTasksPath && options->generateOpsPath) ||
+        options->completedPercent < 0 || options->completedPercent > 100 ||
+        options->startTasks < 0 || (options->batchPath && options->replayPath) ||
+        (options->allocator && findMemoryResource(options->allocator) == NULL) ||
+        ((options->batchPath || options->replayPath || options->recordPath) &&
+         options->servePort > 0) ||
+        (options->recordPath && (options->batchPath || options->replayPath)) ||
+        (options->profileStartup &&
+         (options->servePort > 0 || options->batchPath || options->replayPath)) ||
+        (options->threads != 0 &&
+         (options->servePort <= 0 || options->threads < 1 || options->threads > SHARD_MAX ||
+          options->replicatePath || options->followPath || options->takeoverFd >= 0))) {
+        printf("Usage: %s [--workspace DIR] [--trace FILE] [--allocator NAME]\n"
+               "          [--profile-startup |\n"
+               "          --serve PORT [--memory-budget MB]\n"
+               "          [--replicate SOCKET | --follow SOCKET | --threads N]]\n"
+               "       %s --bench-http PORT [CONNECTIONS] [REQUESTS] [--bench-path PATH]\n"
+               "       %s --bench [MAX_TASKS] [--counters] | --bench-startup [MAX_TASKS]\n"
+               "       %s --generate-tasks FILE COUNT [--seed N] [--completed PCT]\n"
+               "       %s --generate-ops FILE COUNT [--seed N] [--start-tasks N]\n"
+               "       %s [--workspace DIR] --batch FILE | --replay FILE | --record FILE\n",
+               argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * @brief Prints the main menu options.
  */
@@ -157,19 +1400,79 @@ void printMenu(void) {
     printf("2. List all tasks\n");
     printf("3. Mark a task as complete\n");
     printf("4. Delete a task\n");
-    printf("5. Save and Quit\n");
+    printf("5. Search tasks\n");
+    printf("6. Save and Quit\n");
+    printf("7. Show timing stats\n");
+    printf("8. Show memory usage\n");
+    printf("9. Write trace file\n");
     printf("Enter your choice: ");
 }
 
+// Every Task allocated and freed, for printMemoryReport().
+static MemoryStats memoryStats;
+
+// The memory resources --allocator picks from, and the one in use.
+static MemoryResource memoryResources[] = {
+    { "malloc", mallocAllocate, mallocRelease, mallocResize, 0, 0,
+      PTHREAD_MUTEX_INITIALIZER, NULL, 0, { NULL }, 0, 0 },
+    { "monotonic", monotonicAllocate, monotonicRelease, copyResize, 0, 0,
+      PTHREAD_MUTEX_INITIALIZER, NULL, 0, { NULL }, 0, 0 },
+    { "pool", poolAllocate, poolRelease, copyResize, POOL_SLAB, 0,
+      PTHREAD_MUTEX_INITIALIZER, NULL, 0, { NULL }, 0, 0 },
+    { "huge", poolAllocate, poolRelease, copyResize, HUGE_PAGE_SIZE, 1,
+      PTHREAD_MUTEX_INITIALIZER, NULL, 0, { NULL }, 0, 0 },
+};
+static MemoryResource* memoryResource = &memoryResources[0];
+
+/**
+ * @brief Makes a view of a NUL-terminated description.
+ * @param text The text.
+ * @return A view of at most MAX_TASK_LEN - 1 bytes of it.
+ */
+TextView textView(const char* text) {
+    TextView view = { text, strnlen(text, MAX_TASK_LEN - 1) };
+    return view;
+}
+
+/**
+ * @brief Like textView(), but stops at the first line break, as a task
+ * file holds one task per line.
+ * @param text A NUL-terminated string.
+ * @return The view; its length is 0 if the text starts with a break.
+ */
+TextView firstLineView(const char* text) {
+    TextView view = textView(text);
+    size_t length = strcspn(text, "\r\n");
+
+    if (length < view.length) {
+        view.length = length;
+    }
+    return view;
+}
+
 /**
  * @brief Allocates memory for a new Task and initializes it.
  * @param description The text for the new task.
  * @return A pointer to the newly created Task on the heap.
  */
 Task* createTask(const char* description) {
-    // 1. Allocate memory on the heap for one Task struct.
-    // sizeof(Task) calculates the number of bytes needed.
-    Task* newTask = (Task*)malloc(sizeof(Task));
+    return createTaskView(textView(description));
+}
+
+/**
+ * @brief Allocates a new Task and copies a description into it. This is
+ * the one copy a description gets on its way into the list; the caller
+ * owns the task until it hands it to linkTask().
+ * @param description The text (at most MAX_TASK_LEN - 1 bytes are kept).
+ * @return A pointer to the newly created Task on the heap.
+ */
+Task* createTaskView(TextView description) {
+    size_t length = description.length < MAX_TASK_LEN - 1 ? description.length
+                                                          : MAX_TASK_LEN - 1;
+
+    // 1. Allocate memory for one Task struct, from the --allocator resource.
+    // TASK_SIZE() is sizeof(Task), plus the text if it isn't inline.
+    Task* newTask = (Task*)memoryAllocate(TASK_SIZE(length));
 
     // 2. Check if malloc failed (e.g., out of memory).
     if (newTask == NULL) {
@@ -178,224 +1481,7447 @@ Task* createTask(const char* description) {
     }
 
     // 3. Initialize the new task's data.
-    // Use strncpy for safety to avoid buffer overflows.
-    strncpy(newTask->description, description, MAX_TASK_LEN - 1);
-    newTask->description[MAX_TASK_LEN - 1] = '\0'; // Ensure null-termination
+    // Copy at most MAX_TASK_LEN - 1 characters, to avoid buffer overflows.
+    memcpy(newTask->description, description.text, length);
+    newTask->description[length] = '\0'; // Ensure null-termination
+    __atomic_fetch_add(&memoryStats.tasksCreated, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&memoryStats.descriptionBytes, length + 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&memoryStats.bytesCopied, length, __ATOMIC_RELAXED);
     newTask->completed = 0; // New tasks are incomplete by default
+    newTask->id = 0;        // Assigned by the caller when linked
+    newTask->beginVersion = 0;               // Stamped by the caller when linked
+    newTask->endVersion = VERSION_INFINITY;  // Nobody has replaced it yet
     newTask->next = NULL;   // This task is not pointing to anything... yet.
 
     // 4. Return the pointer to the new task.
     return newTask;
 }
 
+/**
+ * @brief Frees a Task made by createTask().
+ * @param task The task (already unlinked).
+ */
+void destroyTask(Task* task) {
+    size_t length = strlen(task->description);
+
+    __atomic_fetch_add(&memoryStats.tasksDestroyed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&memoryStats.descriptionBytes, length + 1, __ATOMIC_RELAXED);
+    memoryRelease(task, TASK_SIZE(length));
+}
+
+/**
+ * @brief Initializes an empty TaskList.
+ * @param list The list to initialize.
+ */
+void initList(TaskList* list) {
+    list->head = NULL;
+    list->tail = NULL;
+    list->version = 0;
+    list->snapshots = NULL;
+    list->snapshotCount = 0;
+    list->snapshotCapacity = 0;
+    list->garbage = 0;
+    list->count = 0;
+    list->done = 0;
+    list->nextId = 1;
+    list->subscribers = NULL;
+    list->lines = NULL;
+    list->lineCount = 0;
+    list->lineCapacity = 0;
+    list->fileSize = 0;
+    list->fileTime.tv_sec = 0;
+    list->fileTime.tv_nsec = 0;
+    strcpy(list->file, FILENAME);
+    list->savedVersion = 0;
+    list->pins = 0;
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    list->positions = NULL;
+    list->positionCapacity = 0;
+#endif
+#if TODO_LOCKING == TODO_LOCKING_MUTEX
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&list->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+#endif
+}
+
+/**
+ * @brief Sets which file a list is loaded from and saved to.
+ * @param list The list.
+ * @param file The file name (fewer than LIST_NAME_MAX + 8 characters).
+ */
+void setListFile(TaskList* list, const char* file) {
+    strncpy(list->file, file, sizeof(list->file) - 1);
+    list->file[sizeof(list->file) - 1] = '\0';
+}
+
 /**
  * @brief Adds a new task to the end of the linked list.
- * @param head A pointer-to-a-pointer to the head of the list.
- * We use this so we can modify the 'head' pointer itself
- * if the list is currently empty.
+ * @param list A pointer to the list. We use this so we can modify
+ * the 'head' pointer itself if the list is currently empty.
  * @param description The text for the new task.
  */
-void addTask(Task** head, const char* description) {
-    Task* newTask = createTask(description);
+void addTask(TaskList* list, const char* description) {
+    addTaskView(list, textView(description));
+}
+
+/**
+ * @brief addTask() for a description that isn't NUL-terminated.
+ * @param list A pointer to the list.
+ * @param description The text for the new task.
+ */
+void addTaskView(TaskList* list, TextView description) {
+    LATENCY_SCOPE(LATENCY_ADD);
+    LIST_LOCK(list);
+    linkTask(list, createTaskView(description));
+}
+
+/**
+ * @brief Appends a task made by createTask() and commits it: the second
+ * half of addTask(), for callers that make the node themselves.
+ * @param list A pointer to the list.
+ * @param newTask The new task (not yet linked anywhere). If its id is
+ * set, it's kept; otherwise it gets the next one.
+ */
+void linkTask(TaskList* list, Task* newTask) {
+    LIST_LOCK(list);
+    unsigned long version = list->version + 1;
+
+    // Stamp the record with the version that creates it. Readers holding
+    // an older snapshot will skip over it.
+    newTask->beginVersion = version;
+    if (newTask->id == 0) {
+        newTask->id = list->nextId++; // Unless the caller gave it one
+    }
 
     // Case 1: The list is empty.
-    if (*head == NULL) {
-        *head = newTask; // The new task is now the head of the list.
-    } 
+    if (list->head == NULL) {
+        list->head = newTask; // The new task is now the head of the list.
+    }
     // Case 2: The list is not empty.
     else {
-        Task* current = *head;
-        // Traverse to the end of the list
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        // 'current' is now the last node. Link the new task.
-        current->next = newTask;
+        // 'tail' is the last node. Link the new task.
+        list->tail->next = newTask;
     }
+    list->tail = newTask;
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    positionsInsert(list, list->count + 1, newTask);
+#endif
+
+    // Commit: the new record is now visible to new snapshots.
+    list->version = version;
+    list->count++;
+    publishChange(list, CHANGE_ADD, list->count, newTask);
 }
 
 /**
- * @brief Displays all tasks in the list, with their index and status.
- * @param head A pointer to the first task in the list.
+ * @brief Inserts a new task so that it ends up at a given position.
+ * @param list A pointer to the list.
+ * @param index The 1-based position for the new task (1 to count + 1).
+ * @param description The text for the new task.
  */
-void displayTasks(Task* head) {
-    if (head == NULL) {
-        printf("\nYour to-do list is empty.\n");
-        return;
-    }
+void insertTask(TaskList* list, int index, const char* description) {
+    insertTaskView(list, index, textView(description));
+}
 
-    printf("\n--- Your Tasks ---\n");
-    Task* current = head;
-    int index = 1;
-    
-    // Traverse the list from head to tail
-    while (current != NULL) {
-        // Print status ([X] or [ ]) and description
-        printf("%d. [%c] %s\n", 
-               index, 
-               (current->completed ? 'X' : ' '), 
-               current->description);
-        
-        current = current->next; // Move to the next task
-        index++;
+/**
+ * @brief insertTask() for a description that isn't NUL-terminated.
+ * @param list A pointer to the list.
+ * @param index The 1-based position for the new task (1 to count + 1).
+ * @param description The text for the new task.
+ */
+void insertTaskView(TaskList* list, int index, TextView description) {
+    LIST_LOCK(list);
+
+    // Appending is the common case, and addTask() does it without a walk.
+    if (index > list->count) {
+        addTaskView(list, description);
+        return;
     }
+    linkTaskAt(list, index, createTaskView(description));
 }
 
 /**
- * @brief Marks a task at a given index as complete.
- * @param head A pointer to the first task in the list.
- * @param index The 1-based index of the task to mark.
+ * @brief Inserts a task made by createTask() at a given position and
+ * commits it: the second half of insertTask(), like linkTask().
+ * @param list A pointer to the list.
+ * @param index The 1-based position for the new task (1 to count + 1).
+ * @param newTask The new task (not yet linked anywhere). If its id is
+ * set, it's kept; otherwise it gets the next one.
  */
-void markComplete(Task* head, int index) {
-    Task* current = head;
-    int count = 1;
+void linkTaskAt(TaskList* list, int index, Task* newTask) {
+    LIST_LOCK(list);
 
-    // Traverse the list to find the Nth task
-    while (current != NULL && count < index) {
-        current = current->next;
-        count++;
+    if (index > list->count) {
+        linkTask(list, newTask);
+        return;
     }
-
-    // Check if we found the task
-    if (current == NULL) {
-        printf("Error: Task %d not found.\n", index);
+    if (index <= 1) {
+        linkTaskAfter(list, NULL, 1, newTask);
     } else {
-        current->completed = 1;
-        printf("Task %d marked as complete.\n", index);
+        linkTaskAfter(list, findTask(list, index - 1, NULL), index, newTask);
     }
 }
 
 /**
- * @brief Deletes a task at a given index from the list.
- * @param head A pointer-to-a-pointer to the head of the list,
- * in case we need to delete the first item.
- * @param index The 1-based index of the task to delete.
+ * @brief Inserts a task made by createTask() right after a given one and
+ * commits it, for callers that already hold the task before the spot
+ * and so needn't walk to it.
+ * @param list A pointer to the list.
+ * @param previous The live task that ends up just before the new one,
+ * or NULL to make the new one the head.
+ * @param index The 1-based position the new task ends up at.
+ * @param newTask The new task (not yet linked anywhere). If its id is
+ * set, it's kept; otherwise it gets the next one.
  */
-void deleteTask(Task** head, int index) {
-    if (*head == NULL) {
-        printf("Error: List is empty, nothing to delete.\n");
-        return;
-    }
+void linkTaskAfter(TaskList* list, Task* previous, int index, Task* newTask) {
+    LIST_LOCK(list);
 
-    Task* temp = NULL;
-    
-    // Case 1: Deleting the head node (index == 1)
-    if (index == 1) {
-        temp = *head;            // 1. Store the node to be deleted
-        *head = (*head)->next;   // 2. Point head to the *next* node
-        free(temp);              // 3. Free the original head node
-        printf("Task 1 deleted.\n");
-        return;
+    newTask->beginVersion = list->version + 1;
+    if (newTask->id == 0) {
+        newTask->id = list->nextId++;
     }
 
-    // Case 2: Deleting a node other than the head
-    Task* current = *head;
-    int count = 1;
-
-    // Traverse to find the node *before* the one to be deleted
-    while (current != NULL && count < index - 1) {
-        current = current->next;
-        count++;
+    if (previous == NULL) {
+        newTask->next = list->head; // The new task becomes the head.
+        list->head = newTask;
+    } else {
+        newTask->next = previous->next;
+        previous->next = newTask;
     }
-
-    // Check if index is valid (i.e., we found the node before,
-    // and the node to be deleted actually exists)
-    if (current == NULL || current->next == NULL) {
-        printf("Error: Task %d not found.\n", index);
-        return;
+    if (newTask->next == NULL) {
+        list->tail = newTask;
     }
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    positionsInsert(list, index, newTask);
+#endif
 
-    // 'current' is now the (index-1)th node
-    temp = current->next;            // 1. Store the node to be deleted (the index-th node)
-    current->next = temp->next;    // 2. Link the (index-1)th node to the (index+1)th node
-    free(temp);                      // 3. Free the deleted node
-    printf("Task %d deleted.\n", index);
+    list->version = newTask->beginVersion;
+    list->count++;
+    publishChange(list, CHANGE_ADD, index, newTask);
 }
 
 /**
- * @brief Frees all memory allocated for the linked list.
- * @param head A pointer to the first task.
+ * @brief Estimates the memory one task record takes.
+ * @return sizeof(Task), plus the average description (NUL included)
+ * when descriptions are sized to fit.
  */
-void freeList(Task* head) {
-    Task* current = head;
-    Task* temp = NULL;
+size_t taskRecordSize(void) {
+#if TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT
+    unsigned long live = __atomic_load_n(&memoryStats.tasksCreated, __ATOMIC_RELAXED) -
+                         __atomic_load_n(&memoryStats.tasksDestroyed, __ATOMIC_RELAXED);
+    unsigned long long text = __atomic_load_n(&memoryStats.descriptionBytes, __ATOMIC_RELAXED);
+    return sizeof(Task) + (live > 0 ? (size_t)(text / live) : 1);
+#else
+    return sizeof(Task);
+#endif
+}
 
-    // Traverse the list, freeing each node one by one
-    while (current != NULL) {
-        temp = current;          // Store the current node
-        current = current->next; // Move to the next node
-        free(temp);              // Free the stored node
-    }
-    // 'head' will be a dangling pointer, but since the program is
-    // exiting (or the list is being reset), this is okay.
+/**
+ * @brief Names the build policies this binary was compiled with.
+ * @return e.g. "list,inline,none" (storage, description, locking).
+ */
+const char* buildPolicies(void) {
+    return TODO_STORAGE == TODO_STORAGE_INDEXED ?
+               (TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT ?
+                    (TODO_LOCKING == TODO_LOCKING_MUTEX ? "indexed,exact,mutex" : "indexed,exact,none") :
+                    (TODO_LOCKING == TODO_LOCKING_MUTEX ? "indexed,inline,mutex" : "indexed,inline,none")) :
+               (TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT ?
+                    (TODO_LOCKING == TODO_LOCKING_MUTEX ? "list,exact,mutex" : "list,exact,none") :
+                    (TODO_LOCKING == TODO_LOCKING_MUTEX ? "list,inline,mutex" : "list,inline,none"));
 }
 
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
 /**
- * @brief Saves the entire linked list to the file "tasks.txt".
- * @param head A pointer to the first task.
+ * @brief Puts a live task into the position array (TODO_STORAGE_INDEXED).
+ * @param list A pointer to the list.
+ * @param index The task's 1-based position (1 to count + 1).
+ * @param task The task.
  */
-void saveTasks(Task* head) {
-    // Open the file in "write" mode ("w").
-    // This will create the file or overwrite it if it exists.
-    FILE *file = fopen(FILENAME, "w"); 
-    if (file == NULL) {
-        printf("Error: Could not open file %s for writing.\n", FILENAME);
-        return;
-    }
+void positionsInsert(TaskList* list, int index, Task* task) {
+    positionsReserve(list, list->count + 1);
+    memmove(&list->positions[index], &list->positions[index - 1],
+            (size_t)(list->count - index + 1) * sizeof(Task*));
+    list->positions[index - 1] = task;
+}
 
-    Task* current = head;
-    // Traverse the list
-    while (current != NULL) {
-        // Write in a "CSV" (Comma Separated Value) format
-        // e.g., "1,Buy milk" or "0,Study for exam"
-        fprintf(file, "%d,%s\n", current->completed, current->description);
-        current = current->next;
+/**
+ * @brief Makes room in the position array (TODO_STORAGE_INDEXED).
+ * @param list A pointer to the list.
+ * @param count How many live tasks it must be able to hold.
+ */
+void positionsReserve(TaskList* list, int count) {
+    if (count > list->positionCapacity) {
+        int capacity = list->positionCapacity > 0 ? list->positionCapacity * 2 : 64;
+        while (capacity < count) {
+            capacity *= 2;
+        }
+        Task** grown = (Task**)memoryResize(list->positions,
+                                            (size_t)list->positionCapacity * sizeof(Task*),
+                                            (size_t)capacity * sizeof(Task*));
+        if (grown == NULL) {
+            printf("Error: Could not allocate memory for the task index.\n");
+            exit(1);
+        }
+        list->positions = grown;
+        list->positionCapacity = capacity;
     }
+}
 
-    // Close the file handle
-    fclose(file);
+/**
+ * @brief Takes a task out of the position array (TODO_STORAGE_INDEXED).
+ * @param list A pointer to the list.
+ * @param index The task's 1-based position.
+ */
+void positionsRemove(TaskList* list, int index) {
+    memmove(&list->positions[index - 1], &list->positions[index],
+            (size_t)(list->count - index) * sizeof(Task*));
 }
+#endif
 
+#if TODO_LOCKING == TODO_LOCKING_MUTEX
 /**
- * @brief Loads tasks from "tasks.txt" into the linked list.
- * @param head A pointer-to-a-pointer to the head of the list.
+ * @brief Takes a list's lock (use LIST_LOCK rather than this).
+ * @param list The list.
+ * @return The list, for listUnlock().
  */
-void loadTasks(Task** head) {
-    // Open the file in "read" mode ("r").
-    FILE *file = fopen(FILENAME, "r");
-    if (file == NULL) {
-        // This is not an error. It just means we have no save file yet.
-        printf("No existing task file found. Starting fresh.\n");
-        return;
-    }
+TaskList* listLock(TaskList* list) {
+    pthread_mutex_lock(&list->lock);
+    return list;
+}
 
-    char lineBuffer[MAX_TASK_LEN + 10]; // Buffer to read each line
-    char description[MAX_TASK_LEN];
-    int completed;
+/**
+ * @brief Releases a list's lock. Called by the cleanup attribute.
+ * @param held The list from listLock().
+ */
+void listUnlock(TaskList** held) {
+    pthread_mutex_unlock(&(*held)->lock);
+}
+#endif
+
+/**
+ * @brief Displays all tasks in the list, with their index and status.
+ * Reads from a snapshot, so the listing is one consistent point in time
+ * even if writes happen while it is being produced.
+ * @param list A pointer to the list.
+ */
+void displayTasks(TaskList* list) {
+    LIST_LOCK(list);
+    LATENCY_SCOPE(LATENCY_LIST);
+    Snapshot snapshot = openSnapshot(list);
+    Task* current = list->head;
+    int index = 1;
+
+    // Traverse the list from head to tail, skipping records that
+    // weren't alive at our snapshot's version.
+    while (current != NULL) {
+        if (isVisible(current, snapshot.version)) {
+            if (index == 1) {
+                printf("\n--- Your Tasks ---\n");
+            }
+            // Print status ([X] or [ ]) and description
+            printf("%d. [%c] %s\n",
+                   index,
+                   (current->completed ? 'X' : ' '),
+                   current->description);
+            index++;
+        }
+        current = current->next; // Move to the next task
+    }
+
+    if (index == 1) {
+        printf("\nYour to-do list is empty.\n");
+    }
+    closeSnapshot(&snapshot);
+}
+
+/**
+ * @brief Marks a task at a given index as complete.
+ * @param list A pointer to the list.
+ * @param index The 1-based index of the task to mark.
+ */
+void markComplete(TaskList* list, int index) {
+    // Check if we found the task
+    if (completeTask(list, index) != 0) {
+        printf("Error: Task %d not found.\n", index);
+    } else {
+        printf("Task %d marked as complete.\n", index);
+    }
+}
+
+/**
+ * @brief Deletes a task at a given index from the list.
+ * @param list A pointer to the list, in case we need to delete the first item.
+ * @param index The 1-based index of the task to delete.
+ */
+void deleteTask(TaskList* list, int index) {
+    if (findTask(list, 1, NULL) == NULL) {
+        printf("Error: List is empty, nothing to delete.\n");
+        return;
+    }
+
+    // Check if index is valid (i.e., the node to be deleted actually exists)
+    if (removeTask(list, index) != 0) {
+        printf("Error: Task %d not found.\n", index);
+    } else {
+        printf("Task %d deleted.\n", index);
+    }
+}
+
+/**
+ * @brief Marks the task at a given index as complete, without printing.
+ * If a snapshot is open, the old record is kept for it and a new record
+ * carrying the completed state is linked right after it.
+ * @param list A pointer to the list.
+ * @param index The 1-based index of the task to mark.
+ * @return 0 on success, -1 if there is no such task.
+ */
+int completeTask(TaskList* list, int index) {
+    LATENCY_SCOPE(LATENCY_MARK);
+    LIST_LOCK(list);
+    Task* current = findTask(list, index, NULL);
+
+    if (current == NULL) {
+        return -1;
+    }
+    if (current->completed) {
+        return 0; // Already done; nothing to version.
+    }
+
+    unsigned long version = list->version + 1;
+
+    if (list->snapshotCount == 0) {
+        // Nobody can be looking at the old state. Update in place.
+        current->completed = 1;
+    } else {
+        // 1. Make the new version of the record.
+        Task* newer = createTask(current->description);
+        newer->completed = 1;
+        newer->id = current->id;
+        newer->beginVersion = version;
+
+        // 2. Link it right after the old version, so positions don't change.
+        newer->next = current->next;
+        current->next = newer;
+        if (list->tail == current) {
+            list->tail = newer;
+        }
+
+        // 3. Retire the old version. Snapshots older than 'version' still see it.
+        current->endVersion = version;
+        list->garbage++;
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+        list->positions[index - 1] = newer;
+#endif
+    }
+
+    list->version = version;
+    list->done++;
+    publishChange(list, CHANGE_MARK, index, current);
+    return 0;
+}
+
+/**
+ * @brief Removes the task at a given index, without printing.
+ * If a snapshot is open, the record is only stamped as deleted and
+ * collectGarbage() unlinks it once no snapshot can see it anymore.
+ * @param list A pointer to the list.
+ * @param index The 1-based index of the task to delete.
+ * @return 0 on success, -1 if there is no such task.
+ */
+int removeTask(TaskList* list, int index) {
+    LATENCY_SCOPE(LATENCY_DELETE);
+    LIST_LOCK(list);
+    Task* previous = NULL;
+    Task* temp = findTask(list, index, &previous);
+
+    if (temp == NULL) {
+        return -1;
+    }
+
+    unsigned long version = list->version + 1;
+    int unlinked = (list->snapshotCount == 0);
+
+    if (unlinked) {
+        // Nobody can be looking at it. Unlink it right away.
+        if (previous == NULL) {
+            list->head = temp->next;     // Deleting the head node
+        } else {
+            previous->next = temp->next; // Link the (index-1)th node to the (index+1)th node
+        }
+        if (list->tail == temp) {
+            list->tail = previous;
+        }
+    } else {
+        // Leave it linked for older snapshots; it is invisible from 'version' on.
+        temp->endVersion = version;
+        list->garbage++;
+    }
+
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    positionsRemove(list, index);
+#endif
+    list->version = version;
+    list->count--;
+    list->done -= temp->completed;
+    publishChange(list, CHANGE_DELETE, index, temp);
+    if (unlinked) {
+        destroyTask(temp);               // Free the deleted node
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees all memory allocated for the linked list.
+ * @param list A pointer to the list.
+ */
+void freeList(TaskList* list) {
+    Task* current = list->head;
+    Task* temp = NULL;
+
+    // Traverse the list, freeing each node one by one
+    while (current != NULL) {
+        temp = current;          // Store the current node
+        current = current->next; // Move to the next node
+        destroyTask(temp);       // Free the stored node
+    }
+    free(list->snapshots);
+    memoryRelease(list->lines, (size_t)list->lineCapacity * sizeof(LineRecord));
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    memoryRelease(list->positions, (size_t)list->positionCapacity * sizeof(Task*));
+#endif
+    while (list->subscribers != NULL) {
+        unsubscribe(list->subscribers);
+    }
+#if TODO_LOCKING == TODO_LOCKING_MUTEX
+    pthread_mutex_destroy(&list->lock); // initList() makes a fresh one
+#endif
+
+    // Leave the list empty (not dangling) so it can be reused,
+    // still tied to the same file.
+    char file[sizeof(list->file)];
+    strcpy(file, list->file);
+    initList(list);
+    setListFile(list, file);
+}
+
+/**
+ * @brief Opens a point-in-time snapshot of the list.
+ * Until closeSnapshot() is called, writers keep every record this
+ * snapshot can see, so reads through it never observe a torn state.
+ * @param list The list to read from.
+ * @return The snapshot handle.
+ */
+Snapshot openSnapshot(TaskList* list) {
+    LIST_LOCK(list);
+    Snapshot snapshot;
+    int slot;
+
+    // Find a free slot, growing the array if all are in use.
+    if (list->snapshotCount == list->snapshotCapacity) {
+        int capacity = list->snapshotCapacity ? list->snapshotCapacity * 2 : 4;
+        unsigned long* grown = (unsigned long*)realloc(list->snapshots,
+                                                       capacity * sizeof(unsigned long));
+        if (grown == NULL) {
+            printf("Error: Could not allocate memory for snapshot.\n");
+            exit(1);
+        }
+        for (slot = list->snapshotCapacity; slot < capacity; slot++) {
+            grown[slot] = VERSION_INFINITY; // Mark the new slots free
+        }
+        list->snapshots = grown;
+        list->snapshotCapacity = capacity;
+    }
+    for (slot = 0; list->snapshots[slot] != VERSION_INFINITY; slot++) {
+        // Keep looking; a free slot is guaranteed by the growth above.
+    }
+
+    list->snapshots[slot] = list->version;
+    list->snapshotCount++;
+
+    snapshot.list = list;
+    snapshot.version = list->version;
+    snapshot.slot = slot;
+    return snapshot;
+}
+
+/**
+ * @brief Closes a snapshot and collects records nobody can see anymore.
+ * @param snapshot The snapshot to close.
+ */
+void closeSnapshot(Snapshot* snapshot) {
+    TaskList* list = snapshot->list;
+    LIST_LOCK(list);
+
+    list->snapshots[snapshot->slot] = VERSION_INFINITY;
+    list->snapshotCount--;
+    if (list->garbage > 0) {
+        collectGarbage(list);
+    }
+}
+
+/**
+ * @brief Checks whether a record was alive at a given version.
+ * @param task The record.
+ * @param version The version being read.
+ * @return 1 if visible, 0 otherwise.
+ */
+int isVisible(const Task* task, unsigned long version) {
+    return task->beginVersion <= version && version < task->endVersion;
+}
+
+/**
+ * @brief Skips records that aren't alive at a version. A reader that
+ * pauses mid-list must stop on one that is: its own snapshot keeps that
+ * record, while an invisible one may be collected when some other
+ * snapshot closes.
+ * @param task Where to start (NULL is fine).
+ * @param version The version being read.
+ * @return 'task' or the first record after it visible at 'version', or NULL.
+ */
+Task* firstVisible(Task* task, unsigned long version) {
+    while (task != NULL && !isVisible(task, version)) {
+        task = task->next;
+    }
+    return task;
+}
+
+/**
+ * @brief Finds the task at a 1-based index in the latest version.
+ * @param list A pointer to the list.
+ * @param index The 1-based index of the task.
+ * @param previous If not NULL, receives the node before the found one
+ * (NULL when the found node is the head).
+ * @return The task, or NULL if the index is out of range.
+ */
+Task* findTask(TaskList* list, int index, Task** previous) {
+    Task* before = NULL;
+    Task* current = list->head;
+    int count = 0;
+
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    if (index < 1 || index > list->count) {
+        return NULL;
+    }
+    current = list->positions[index - 1];
+    if (previous != NULL) {
+        // Old versions kept for snapshots may sit between two live tasks,
+        // so step from the live task before this one to its neighbour.
+        before = index > 1 ? list->positions[index - 2] : NULL;
+        if (list->garbage > 0) {
+            Task* walk = before != NULL ? before : list->head;
+            if (walk != current) {
+                while (walk->next != current) {
+                    walk = walk->next;
+                }
+                before = walk;
+            }
+        }
+        *previous = before;
+    }
+    return current;
+#endif
+
+
+    // Traverse the list to find the Nth live task
+    while (current != NULL) {
+        if (isVisible(current, list->version) && ++count == index) {
+            break;
+        }
+        before = current;
+        current = current->next;
+    }
+
+    if (previous != NULL) {
+        *previous = before;
+    }
+    return current;
+}
+
+/**
+ * @brief Finds the position of the live task with a given ID.
+ * @param list A pointer to the list.
+ * @param id The task's stable ID.
+ * @return The 1-based position, or 0 if no live task has that ID.
+ */
+int findTaskIndexById(TaskList* list, unsigned long id) {
+    LIST_LOCK(list);
+    Task* current;
+    int index = 0;
+
+    for (current = list->head; current != NULL; current = current->next) {
+        if (isVisible(current, list->version)) {
+            index++;
+            if (current->id == id) {
+                return index;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Unlinks and frees records that no open snapshot can see.
+ * @param list A pointer to the list.
+ */
+void collectGarbage(TaskList* list) {
+    TRACE_SPAN("collect garbage");
+    LIST_LOCK(list);
+    // The oldest version still being read. Anything that ended at or
+    // before it is invisible to every reader.
+    unsigned long oldest = list->version + 1;
+    int i;
+    for (i = 0; i < list->snapshotCapacity; i++) {
+        if (list->snapshots[i] < oldest) {
+            oldest = list->snapshots[i]; // Free slots hold VERSION_INFINITY
+        }
+    }
+
+    Task** link = &list->head;
+    Task* previous = NULL;
+    while (*link != NULL) {
+        Task* current = *link;
+        if (current->endVersion <= oldest) {
+            *link = current->next; // Unlink it
+            if (list->tail == current) {
+                list->tail = previous;
+            }
+            destroyTask(current);
+            list->garbage--;
+        } else {
+            previous = current;
+            link = &current->next;
+        }
+    }
+}
+
+/**
+ * @brief Starts delivering changes of a list to a new subscriber.
+ * The subscriber sees every change committed after this call, in order.
+ * @param list The list to watch.
+ * @return The subscriber, to be read with peekChange()/consumeChange().
+ */
+Subscriber* subscribe(TaskList* list) {
+    LIST_LOCK(list);
+    Subscriber* subscriber = (Subscriber*)malloc(sizeof(Subscriber));
+    if (subscriber == NULL) {
+        printf("Error: Could not allocate memory for subscriber.\n");
+        exit(1);
+    }
+    subscriber->list = list;
+    subscriber->head = 0;
+    subscriber->tail = 0;
+    subscriber->overflowed = 0;
+
+    // Push it onto the front of the list's subscribers.
+    subscriber->next = list->subscribers;
+    list->subscribers = subscriber;
+    return subscriber;
+}
+
+/**
+ * @brief Stops delivering changes to a subscriber and frees it.
+ * @param subscriber The subscriber to remove.
+ */
+void unsubscribe(Subscriber* subscriber) {
+    Subscriber** link = &subscriber->list->subscribers;
+    while (*link != subscriber) {
+        link = &(*link)->next;
+    }
+    *link = subscriber->next;
+    free(subscriber);
+}
+
+/**
+ * @brief Queues a change for every subscriber of a list.
+ * Called by the writers right after they commit, so 'list->version'
+ * is the change's sequence number. Costs O(subscribers), never blocks.
+ * @param list The list that changed.
+ * @param type What happened.
+ * @param index The task's position at the time of the change.
+ * @param task The task that changed.
+ */
+void publishChange(TaskList* list, ChangeType type, int index, const Task* task) {
+    Subscriber* subscriber;
+    for (subscriber = list->subscribers; subscriber != NULL; subscriber = subscriber->next) {
+        if (subscriber->tail - subscriber->head == SUBSCRIBER_RING_SIZE) {
+            subscriber->overflowed = 1; // Slow consumer: drop, don't wait.
+            continue;
+        }
+        if (subscriber->overflowed) {
+            continue; // Already out of sync; later events are useless to it.
+        }
+        ChangeEvent* event = &subscriber->events[subscriber->tail % SUBSCRIBER_RING_SIZE];
+        event->sequence = list->version;
+        event->type = type;
+        event->index = index;
+        event->id = task->id;
+        if (type == CHANGE_ADD) {
+            strcpy(event->description, task->description);
+        } else {
+            event->description[0] = '\0';
+        }
+        subscriber->tail++;
+    }
+}
+
+/**
+ * @brief Returns the oldest unread change, without removing it.
+ * @param subscriber The subscriber.
+ * @return The change, or NULL if there is none.
+ */
+ChangeEvent* peekChange(Subscriber* subscriber) {
+    if (subscriber->head == subscriber->tail) {
+        return NULL;
+    }
+    return &subscriber->events[subscriber->head % SUBSCRIBER_RING_SIZE];
+}
+
+/**
+ * @brief Removes the oldest unread change.
+ * @param subscriber The subscriber.
+ */
+void consumeChange(Subscriber* subscriber) {
+    subscriber->head++;
+}
+
+/**
+ * @brief Saves the entire linked list to the file "tasks.txt".
+ * @param list A pointer to the list.
+ */
+void saveTasks(TaskList* list) {
+    if (writeTasks(list) != 0) {
+        printf("Error: Could not open file %s for writing.\n", list->file);
+    }
+}
+
+/**
+ * @brief Saves the list to its file, without printing.
+ * Writes from a snapshot, so the file is one consistent point in time.
+ * Also rebuilds the line index, so our own write isn't mistaken for
+ * an external edit.
+ * @param list A pointer to the list.
+ * @return 0 on success, -1 (with errno set) if the file couldn't be opened.
+ */
+int writeTasks(TaskList* list) {
+    LATENCY_SCOPE(LATENCY_SAVE);
+    LIST_LOCK(list);
+    // Open the file in "write" mode ("w").
+    // This will create the file or overwrite it if it exists.
+    FILE *file = fopen(list->file, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char lineBuffer[MAX_TASK_LEN + 10]; // One formatted line
+    off_t offset = 0;
+
+    Snapshot snapshot = openSnapshot(list);
+    Task* current = list->head;
+    list->lineCount = 0;
+    // Traverse the list
+    while (current != NULL) {
+        if (isVisible(current, snapshot.version)) {
+            // Write in a "CSV" (Comma Separated Value) format
+            // e.g., "1,Buy milk" or "0,Study for exam"
+            int length = snprintf(lineBuffer, sizeof(lineBuffer), "%d,%s",
+                                  current->completed, current->description);
+            fprintf(file, "%s\n", lineBuffer);
+            indexLine(list, offset, lineBuffer, (size_t)length, current->id);
+            offset += length + 1;
+        }
+        current = current->next;
+    }
+    closeSnapshot(&snapshot);
+
+    // Close the file handle
+    fclose(file);
+    metricAdd(METRIC_BYTES_WRITTEN, (unsigned long)offset);
+    recordFileState(list, offset);
+    list->savedVersion = snapshot.version;
+    return 0;
+}
+
+/**
+ * @brief Loads tasks from "tasks.txt" into the linked list.
+ * @param list A pointer to the list.
+ */
+void loadTasks(TaskList* list) {
+    if (readTasks(list) != 0) {
+        // This is not an error. It just means we have no save file yet.
+        printf("No existing task file found. Starting fresh.\n");
+    } else {
+        printf("Tasks loaded from %s.\n", list->file);
+    }
+}
+
+/**
+ * @brief Loads the list's file into the list, without printing.
+ * @param list A pointer to the list.
+ * @return 0 on success, -1 (with errno set) if the file couldn't be opened.
+ */
+int readTasks(TaskList* list) {
+    LATENCY_SCOPE(LATENCY_LOAD);
+    LIST_LOCK(list);
+    // With --trace or --profile-startup: time spent opening, reading,
+    // parsing, making nodes, linking them and indexing lines. Only every
+    // LOAD_SAMPLE_EVERY-th line is timed phase by phase, so the clock
+    // reads don't swamp what they measure.
+    long long phases[LOAD_PHASES] = { 0 };
+    long long begun = loadProfileBegin();
+    long long mark = 0;
+    long lines = 0;
+
+    // Open the file in "read" mode ("r").
+    FILE *file = fopen(list->file, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char* line = NULL;        // getline() grows this to fit each line
+    size_t capacity = 0;
+    ssize_t length;
+    off_t offset = 0;
+    TextView description;   // Points into 'line'; copied once, into the task
+    int completed;
+    long long opened = begun != 0 ? nowNanos() : 0;
+    mark = opened;
 
     // Read one line at a time from the file until we reach the end
-    while (fgets(lineBuffer, sizeof(lineBuffer), file) != NULL) {
-        // Parse the line from the buffer.
-        // The format %[^\n] means "read everything until a newline".
-        if (sscanf(lineBuffer, "%d,%[^\n]", &completed, description) == 2) {
-            // We have good data. Add it to our list.
-            // We re-use addTask, which is efficient.
-            addTask(head, description);
-            
-            // If the loaded task was complete, we must find it
-            // in the list and mark it.
+    while ((length = getline(&line, &capacity, file)) > 0) {
+        unsigned long id = 0;
+        size_t text = (size_t)length - (line[length - 1] == '\n');
+        int parsed;
+
+        tracePhase(&phases[LOAD_READ], &mark);
+        parsed = parseTaskLine(line, &completed, &description);
+        tracePhase(&phases[LOAD_PARSE], &mark);
+        if (parsed) {
+            // We have good data. Add it to our list: what addTask()
+            // does, in two steps so a profile can tell them apart.
+            // Appending at the tail keeps this linear.
+            Task* task = createTaskView(description);
+            tracePhase(&phases[LOAD_CREATE], &mark);
+            linkTask(list, task);
+            id = task->id;
+
+            // If the loaded task was complete, mark the new tail.
+            // Nobody holds a snapshot during load, so set it in place.
             if (completed) {
-                Task* current = *head;
-                // Go to the end of the list (where addTask just put it)
-                while (current->next != NULL) {
-                    current = current->next;
-                }
-                // Mark that new node as complete.
-                current->completed = 1;
+                list->tail->completed = 1;
+                list->done++;
             }
+            tracePhase(&phases[LOAD_LINK], &mark);
         }
+
+        // Remember the line, to spot external edits to it later.
+        indexLine(list, offset, line, text, id);
+        offset += length;
+        tracePhase(&phases[LOAD_INDEX], &mark);
+        mark = (begun != 0 && ++lines % LOAD_SAMPLE_EVERY == 0) ? nowNanos() : 0;
+    }
+    if (begun != 0) {
+        loadProfileEnd(phases, begun, opened, nowNanos());
     }
 
+    free(line);
     fclose(file);
-    printf("Tasks loaded from %s.\n", FILENAME);
+    metricAdd(METRIC_BYTES_READ, (unsigned long)offset);
+    recordFileState(list, offset);
+    list->savedVersion = list->version;
+    return 0;
+}
+
+/**
+ * @brief Parses one "completed,description" line of the task file.
+ * The description isn't copied out: it's returned as a view into 'line'.
+ * @param line The line (a trailing newline is ignored).
+ * @param completed Receives the completion flag.
+ * @param description Receives the text (at most MAX_TASK_LEN - 1 bytes).
+ * @return 1 if the line held a task, 0 if it was malformed.
+ */
+int parseTaskLine(const char* line, int* completed, TextView* description) {
+    char* end;
+    long flag = strtol(line, &end, 10);
+    size_t length;
+
+    // A number, a comma, then at least one character before the newline:
+    // what sscanf("%d,%255[^\n]") used to accept, without the copy.
+    if (end == line || *end != ',') {
+        return 0;
+    }
+    end++;
+    length = strcspn(end, "\n");
+    if (length == 0) {
+        return 0;
+    }
+    *completed = (int)flag;
+    description->text = end;
+    description->length = length < MAX_TASK_LEN - 1 ? length : MAX_TASK_LEN - 1;
+    return 1;
+}
+
+// --- File Watching ---
+//
+// When another program edits tasks.txt while we're running, we want to
+// pick up just what changed. The list keeps a LineRecord per file line
+// (offset, length, hash and the task it became). If the file only grew
+// and its old last line is intact, the new bytes are appends: parse just
+// the tail. Otherwise hash every line and compare with the records: lines
+// in the unchanged prefix and suffix are skipped, and only the tasks from
+// the differing range in the middle are removed and re-created.
+
+/**
+ * @brief Starts watching the task file for changes by other programs.
+ * We watch the directory rather than the file, so editors that save by
+ * writing a new file and renaming it over tasks.txt are noticed too.
+ * @return An inotify descriptor for reloadChangedTasks(), or -1.
+ */
+int watchTasksFile(void) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Drains pending inotify events and re-syncs if tasks.txt changed.
+ * Never blocks; call it whenever it's convenient to pick up edits.
+ * @param list A pointer to the list.
+ * @param watchFd The descriptor from watchTasksFile() (-1 = not watching).
+ * @return The number of tasks added or removed.
+ */
+int reloadChangedTasks(TaskList* list, int watchFd) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    int touched = 0;
+
+    if (watchFd < 0) {
+        return 0;
+    }
+    while ((length = read(watchFd, events, sizeof(events))) > 0) {
+        char* position = events;
+        while (position < events + length) {
+            struct inotify_event* event = (struct inotify_event*)position;
+            if (event->len > 0 && strcmp(event->name, list->file) == 0) {
+                touched = 1;
+            }
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (!touched) {
+        return 0;
+    }
+
+    int changed = syncTasksFile(list);
+    if (changed > 0) {
+        printf("\n%s changed on disk; reloaded %d task(s).\n", list->file, changed);
+    }
+    return changed;
+}
+
+/**
+ * @brief Brings the list in line with edits made to the task file.
+ * @param list A pointer to the list.
+ * @return The number of tasks added or removed.
+ */
+int syncTasksFile(TaskList* list) {
+    LIST_LOCK(list);
+    TRACE_SPAN("sync file");
+    struct stat info;
+    FILE* file;
+    int changed;
+
+    if (stat(list->file, &info) != 0) {
+        return 0; // Deleted; keep what we have, the next save recreates it.
+    }
+    if (info.st_size == list->fileSize &&
+        info.st_mtim.tv_sec == list->fileTime.tv_sec &&
+        info.st_mtim.tv_nsec == list->fileTime.tv_nsec) {
+        return 0; // Nothing new (e.g. the event was our own save).
+    }
+
+    file = fopen(list->file, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    // Appended if the file grew and the old last line is still in place.
+    int appended = (info.st_size > list->fileSize);
+    if (appended && list->lineCount > 0) {
+        LineRecord* last = &list->lines[list->lineCount - 1];
+        char lineBuffer[MAX_TASK_LEN + 10];
+        appended = last->length < sizeof(lineBuffer) &&
+                   pread(fileno(file), lineBuffer, last->length + 1, last->offset) ==
+                       (ssize_t)(last->length + 1) &&
+                   lineBuffer[last->length] == '\n' &&
+                   hashLine(lineBuffer, last->length) == last->hash &&
+                   last->offset + (off_t)last->length + 1 == list->fileSize;
+    }
+
+    changed = appended ? loadAppendedLines(list, file) : reloadChangedLines(list, file);
+    fclose(file);
+    return changed;
+}
+
+/**
+ * @brief Adds tasks for the complete lines past the indexed part of the file.
+ * A last line without its newline yet is left for the next sync.
+ * @param list A pointer to the list.
+ * @param file The task file, open for reading.
+ * @return The number of tasks added.
+ */
+int loadAppendedLines(TaskList* list, FILE* file) {
+    TRACE_SPAN("load appended lines");
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    off_t offset = list->fileSize;
+    TextView description;
+    int completed;
+    int added = 0;
+    int reused = list->lineCount;
+
+    fseeko(file, offset, SEEK_SET);
+    while ((length = getline(&line, &capacity, file)) > 0 && line[length - 1] == '\n') {
+        unsigned long id = 0;
+        if (parseTaskLine(line, &completed, &description)) {
+            addTaskView(list, description);
+            id = list->tail->id;
+            if (completed) {
+                // The new tail, just linked: mark it in place, as
+                // readTasks() does, instead of walking to it.
+                list->tail->completed = 1;
+                list->done++;
+                publishChange(list, CHANGE_MARK, list->count, list->tail);
+            }
+            added++;
+        }
+        indexLine(list, offset, line, (size_t)length - 1, id);
+        offset += length;
+    }
+
+    free(line);
+    metricAdd(METRIC_BYTES_READ, (unsigned long)(offset - list->fileSize));
+    metricAdd(METRIC_LINES_REUSED, (unsigned long)reused);
+    metricAdd(METRIC_LINES_PARSED, (unsigned long)(list->lineCount - reused));
+    recordFileState(list, offset);
+    return added;
+}
+
+/**
+ * @brief Re-syncs after an edit that wasn't a plain append.
+ * Only the tasks made from lines in the changed middle range are
+ * removed, and only the new lines in that range are parsed. Both take
+ * one walk of the list, however many lines changed.
+ * @param list A pointer to the list.
+ * @param file The task file, open for reading.
+ * @return The number of tasks added or removed.
+ */
+int reloadChangedLines(TaskList* list, FILE* file) {
+    TRACE_SPAN("reload changed lines");
+    LineRecord* old = list->lines;
+    int oldCount = list->lineCount;
+    int oldCapacity = list->lineCapacity;
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    off_t offset = 0;
+    TextView description;
+    int completed;
+    int changed = 0;
+    int prefix = 0;
+    int suffix = 0;
+    int i;
+
+    // 1. Hash every line of the new file into a fresh index.
+    list->lines = NULL;
+    list->lineCount = 0;
+    list->lineCapacity = 0;
+    while ((length = getline(&line, &capacity, file)) > 0) {
+        indexLine(list, offset, line, (size_t)length - (line[length - 1] == '\n'), 0);
+        offset += length;
+    }
+    LineRecord* now = list->lines;
+    int nowCount = list->lineCount;
+
+    // 2. Match up the unchanged lines at both ends.
+    while (prefix < oldCount && prefix < nowCount && old[prefix].hash == now[prefix].hash) {
+        now[prefix].id = old[prefix].id;
+        prefix++;
+    }
+    while (suffix < oldCount - prefix && suffix < nowCount - prefix &&
+           old[oldCount - 1 - suffix].hash == now[nowCount - 1 - suffix].hash) {
+        now[nowCount - 1 - suffix].id = old[oldCount - 1 - suffix].id;
+        suffix++;
+    }
+
+    // 3. Remove the tasks made from the old middle lines: look their ids
+    // up in one walk, then delete them as one batch.
+    int middle = oldCount - prefix - suffix;
+    unsigned long* ids = (unsigned long*)malloc((size_t)(middle > 0 ? middle : 1) * sizeof(unsigned long));
+    int* doomed = (int*)malloc((size_t)(middle > 0 ? middle : 1) * sizeof(int));
+    int idCount = 0;
+    int doomedCount = 0;
+    int position = 0;
+    Task* current;
+
+    if (ids == NULL || doomed == NULL) {
+        printf("Error: Could not allocate memory for reload.\n");
+        exit(1);
+    }
+    for (i = prefix; i < oldCount - suffix; i++) {
+        if (old[i].id != 0) {
+            ids[idCount++] = old[i].id;
+        }
+    }
+    qsort(ids, (size_t)idCount, sizeof(unsigned long), compareIds);
+    for (current = list->head; current != NULL && idCount > 0; current = current->next) {
+        if (isVisible(current, list->version)) {
+            position++;
+            if (bsearch(&current->id, ids, (size_t)idCount, sizeof(unsigned long), compareIds)) {
+                doomed[doomedCount++] = position;
+            }
+        }
+    }
+    changed += removeTasks(list, doomed, doomedCount);
+    free(doomed);
+    free(ids);
+
+    // 4. Insert tasks for the new middle lines, after the task of the
+    // last unchanged line that still has one (a blank or malformed line
+    // has none, and a task may have been deleted here since), or at the
+    // head if none does. Each goes right after the one before, so
+    // there's no walk.
+    Task* previous = NULL;
+    position = 0;
+    for (i = prefix - 1; i >= 0 && position == 0; i--) {
+        position = old[i].id ? findTaskIndexById(list, old[i].id) : 0;
+    }
+    if (position > 0) {
+        previous = findTask(list, position, NULL);
+    }
+    for (i = prefix; i < nowCount - suffix; i++) {
+        fseeko(file, now[i].offset, SEEK_SET);
+        metricAdd(METRIC_BYTES_READ, now[i].length + 1);
+        if (getline(&line, &capacity, file) > 0 &&
+            parseTaskLine(line, &completed, &description)) {
+            Task* task = createTaskView(description);
+            linkTaskAfter(list, previous, ++position, task);
+            if (completed) {
+                // Just linked: mark it in place, as loadAppendedLines() does.
+                task->completed = 1;
+                list->done++;
+                publishChange(list, CHANGE_MARK, position, task);
+            }
+            now[i].id = task->id;
+            previous = task;
+            changed++;
+        }
+    }
+
+    free(line);
+    memoryRelease(old, (size_t)oldCapacity * sizeof(LineRecord));
+    metricAdd(METRIC_BYTES_READ, (unsigned long)offset);
+    metricAdd(METRIC_LINES_REUSED, (unsigned long)(prefix + suffix));
+    metricAdd(METRIC_LINES_PARSED, (unsigned long)(nowCount - prefix - suffix));
+    recordFileState(list, offset);
+    return changed;
+}
+
+/**
+ * @brief Appends a record for one file line to the list's line index.
+ * @param list A pointer to the list.
+ * @param offset Where the line starts in the file.
+ * @param line The line's bytes.
+ * @param length Bytes in the line, not counting the newline.
+ * @param id The task made from the line (0 = none).
+ */
+void indexLine(TaskList* list, off_t offset, const char* line, size_t length, unsigned long id) {
+    if (list->lineCount == list->lineCapacity) {
+        int capacity = list->lineCapacity ? list->lineCapacity * 2 : 64;
+        LineRecord* grown = (LineRecord*)memoryResize(list->lines,
+                                                      list->lineCapacity * sizeof(LineRecord),
+                                                      capacity * sizeof(LineRecord));
+        if (grown == NULL) {
+            printf("Error: Could not allocate memory for line index.\n");
+            exit(1);
+        }
+        list->lines = grown;
+        list->lineCapacity = capacity;
+    }
+
+    LineRecord* record = &list->lines[list->lineCount++];
+    record->offset = offset;
+    record->length = length;
+    record->hash = hashLine(line, length);
+    record->id = id;
+}
+
+/**
+ * @brief Remembers how much of the task file the line index covers and
+ * the file's modification time, so unchanged files are skipped quickly.
+ * @param list A pointer to the list.
+ * @param size Bytes of the file the index covers.
+ */
+void recordFileState(TaskList* list, off_t size) {
+    struct stat info;
+
+    list->fileSize = size;
+    if (stat(list->file, &info) == 0) {
+        list->fileTime = info.st_mtim;
+    }
+}
+
+/**
+ * @brief Hashes a line's bytes (64-bit FNV-1a).
+ * @param text The bytes.
+ * @param length How many bytes.
+ * @return The hash.
+ */
+unsigned long hashLine(const char* text, size_t length) {
+    unsigned long hash = 14695981039346656037UL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Prints every task whose description contains a search term.
+ * Reads from a snapshot, like displayTasks(). The printed numbers are
+ * the tasks' positions in the full list, so they can be used to mark
+ * or delete a match.
+ * @param list A pointer to the list.
+ * @param query The text to look for (case-sensitive).
+ */
+void searchTasks(TaskList* list, const char* query) {
+    LIST_LOCK(list);
+    Snapshot snapshot = openSnapshot(list);
+    Task* current = list->head;
+    int index = 1;
+    int matches = 0;
+
+    while (current != NULL) {
+        if (isVisible(current, snapshot.version)) {
+            if (strstr(current->description, query) != NULL) {
+                if (matches == 0) {
+                    printf("\n--- Matching Tasks ---\n");
+                }
+                printf("%d. [%c] %s\n",
+                       index,
+                       (current->completed ? 'X' : ' '),
+                       current->description);
+                matches++;
+            }
+            index++;
+        }
+        current = current->next;
+    }
+
+    if (matches == 0) {
+        printf("\nNo tasks match \"%s\".\n", query);
+    }
+    closeSnapshot(&snapshot);
+}
+
+// --- HTTP/JSON Server ---
+//
+// A small HTTP/1.1 server for localhost, built on poll() so one thread
+// can serve many keep-alive connections. Routes:
+//
+//   GET    /tasks              -> JSON array of all tasks
+//   GET    /search?q=TEXT      -> JSON array of tasks containing TEXT
+//   POST   /tasks              -> add a task; the body is the description
+//   POST   /tasks/N/complete   -> mark task N complete
+//   DELETE /tasks/N            -> delete task N
+//   POST   /save               -> save the list to tasks.txt
+//   GET    /subscribe          -> stream of changes (see below)
+//   GET    /replication        -> replication role, versions and lag
+//   GET    /stats              -> connection and request queue depths
+//   GET    /metrics            -> counters and gauges, in Prometheus text format
+//   POST   /trace              -> write the --trace file now
+//   GET    /lists              -> the lists in the workspace
+//   GET    /workspace          -> loaded lists, memory used and evictions
+//   ...    /lists/NAME/...     -> any of the task routes, on the list NAME
+//   POST   /promote            -> turn a follower into a writable server
+//
+// Task arrays are streamed with chunked encoding straight from a snapshot
+// into the connection's fixed output buffer, so a listing of millions of
+// tasks needs no allocation and other clients keep being served between
+// chunks.
+//
+// GET /subscribe answers with newline-delimited JSON that never ends on
+// its own: first one {"type":"task",...} line per task, then
+// {"type":"ready","seq":V}, then one line per change committed after V
+// ({"type":"add"|"mark"|"delete","seq":S,"index":N,"id":I,...}). A
+// subscriber that falls more than SUBSCRIBER_RING_SIZE changes behind
+// gets {"type":"overflow"} and is disconnected; it should subscribe again.
+
+/**
+ * @brief Appends a quoted, escaped JSON string to a buffer.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ * @param text The NUL-terminated text to encode.
+ * @return Bytes written, or 0 if it didn't fit.
+ */
+size_t jsonPutString(char* out, size_t room, const char* text) {
+    static const char hex[] = "0123456789abcdef";
+    size_t used = 0;
+
+    if (room < 2) {
+        return 0;
+    }
+    out[used++] = '"';
+    for (; *text != '\0'; text++) {
+        unsigned char c = (unsigned char)*text;
+        // Leave room for the worst case (\u00XX) plus the closing quote.
+        if (used + 7 > room) {
+            return 0;
+        }
+        if (c == '"' || c == '\\') {
+            out[used++] = '\\';
+            out[used++] = (char)c;
+        } else if (c < 0x20) {
+            memcpy(out + used, "\\u00", 4);
+            out[used + 4] = hex[c >> 4];
+            out[used + 5] = hex[c & 0xf];
+            used += 6;
+        } else {
+            out[used++] = (char)c;
+        }
+    }
+    out[used++] = '"';
+    return used;
+}
+
+/**
+ * @brief Appends one task as a JSON object to a buffer.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ * @param type If not NULL, added as a "type" member first.
+ * @param index The task's 1-based position.
+ * @param task The task to encode.
+ * @return Bytes written, or 0 if it didn't fit.
+ */
+size_t jsonPutTask(char* out, size_t room, const char* type, int index, const Task* task) {
+    int head = snprintf(out, room,
+                        "{%s%s%s\"index\":%d,\"id\":%lu,\"completed\":%s,\"description\":",
+                        type ? "\"type\":\"" : "", type ? type : "", type ? "\"," : "",
+                        index, task->id, task->completed ? "true" : "false");
+    if (head < 0 || (size_t)head >= room) {
+        return 0;
+    }
+    size_t text = jsonPutString(out + head, room - head - 1, task->description);
+    if (text == 0) {
+        return 0;
+    }
+    out[head + text] = '}';
+    return head + text + 1;
+}
+
+/**
+ * @brief Appends one change event as a JSON object to a buffer.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ * @param event The change to encode.
+ * @return Bytes written, or 0 if it didn't fit.
+ */
+size_t jsonPutChange(char* out, size_t room, const ChangeEvent* event) {
+    static const char* names[] = { "add", "mark", "delete" };
+    int head = snprintf(out, room, "{\"type\":\"%s\",\"seq\":%lu,\"index\":%d,\"id\":%lu",
+                        names[event->type], event->sequence, event->index, event->id);
+    size_t used;
+
+    if (head < 0 || (size_t)head + 1 >= room) {
+        return 0;
+    }
+    used = (size_t)head;
+    if (event->type == CHANGE_ADD) {
+        size_t text;
+        if (used + 16 >= room) {
+            return 0;
+        }
+        memcpy(out + used, ",\"description\":", 15);
+        used += 15;
+        text = jsonPutString(out + used, room - used - 1, event->description);
+        if (text == 0) {
+            return 0;
+        }
+        used += text;
+    }
+    out[used++] = '}';
+    return used;
+}
+
+// Set by SIGINT/SIGTERM so the server can save and shut down cleanly.
+static volatile sig_atomic_t stopRequested = 0;
+static volatile sig_atomic_t restartRequested = 0;
+
+/**
+ * @brief Signal handler that asks the server loop to stop.
+ */
+static void requestStop(int signal) {
+    (void)signal;
+    stopRequested = 1;
+}
+
+/**
+ * @brief Signal handler that asks the server loop to hand off to a new process.
+ */
+static void requestRestart(int signal) {
+    (void)signal;
+    restartRequested = 1;
+}
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ */
+long long nowNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Decodes %XX and '+' escapes of a URL query value in place.
+ * @param text The text to decode.
+ */
+void urlDecode(char* text) {
+    char* out = text;
+    for (; *text != '\0'; text++) {
+        if (*text == '+') {
+            *out++ = ' ';
+        } else if (*text == '%' && isxdigit((unsigned char)text[1]) &&
+                   isxdigit((unsigned char)text[2])) {
+            char hex[3] = { text[1], text[2], '\0' };
+            *out++ = (char)strtol(hex, NULL, 16);
+            text += 2;
+        } else {
+            *out++ = *text;
+        }
+    }
+    *out = '\0';
+}
+
+/**
+ * @brief Creates a non-blocking TCP socket listening on 127.0.0.1.
+ * @param port The port to listen on.
+ * @return The socket, or -1 on error.
+ */
+int openListener(int port, int shared) {
+    struct sockaddr_in address;
+    int yes = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (shared) {
+        // Each shard listens on the port; the kernel spreads connections.
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local clients only
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Resets a connection slot to "unused".
+ * @param client The slot.
+ */
+void httpReset(HttpClient* client) {
+    if (client->streaming) {
+        closeSnapshot(&client->snapshot);
+    }
+    if (client->subscriber != NULL) {
+        unsubscribe(client->subscriber);
+    }
+    if (client->job != NULL) {
+        client->job->client = NULL; // The job finishes, with nobody to tell.
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+}
+
+/**
+ * @brief Closes a connection and takes it out of the server's counts.
+ * @param server The server.
+ * @param client The connection.
+ */
+void httpCloseClient(Server* server, HttpClient* client) {
+    server->queuedRequests -= client->queued;
+    server->connections--;
+    httpReset(client);
+}
+
+/**
+ * @brief Queues the requests that have just fully arrived on a connection.
+ * Each connection may queue HTTP_MAX_PIPELINE requests and the server
+ * HTTP_MAX_QUEUED in all; requests past that are marked to be refused.
+ * Responses go out in request order, so once one request on a connection
+ * is refused, the ones after it are too, until the refusals are sent.
+ * @param server The server.
+ * @param client The connection, after bytes were added to its input.
+ */
+void httpAdmitRequests(Server* server, HttpClient* client) {
+    int arrived = httpCountRequests(client->in, client->inLen) - client->queued - client->refused;
+    int room = HTTP_MAX_PIPELINE - client->queued;
+
+    if (room > HTTP_MAX_QUEUED - server->queuedRequests) {
+        room = HTTP_MAX_QUEUED - server->queuedRequests;
+    }
+    if (client->refused > 0 || room < 0) {
+        room = 0;
+    }
+    if (arrived <= 0) {
+        return;
+    }
+    if (arrived < room) {
+        room = arrived;
+    }
+    // The clock starts when a request is complete.
+    if (client->queued == 0 && room > 0) {
+        client->queuedSince = nowNanos();
+    }
+    client->queued += room;
+    client->refused += arrived - room;
+    server->queuedRequests += room;
+    if (server->queuedRequests > server->peakQueued) {
+        server->peakQueued = server->queuedRequests;
+    }
+}
+
+/**
+ * @brief Counts the complete requests at the start of a buffer.
+ * @param in Received bytes.
+ * @param length How many.
+ * @return The number of requests whose headers and body have all arrived.
+ */
+int httpCountRequests(const char* in, size_t length) {
+    size_t position = 0;
+    int count = 0;
+
+    while (position < length) {
+        const char* start = in + position;
+        const char* end = (const char*)memmem(start, length - position, "\r\n\r\n", 4);
+        const char* line;
+        size_t contentLength = 0;
+
+        if (end == NULL) {
+            break;
+        }
+        for (line = start; line != NULL && line < end; ) {
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                contentLength = strtoul(line + 15, NULL, 10);
+            }
+            line = (const char*)memchr(line, '\n', end - line);
+            if (line != NULL) {
+                line++;
+            }
+        }
+        position += (size_t)(end - start) + 4 + contentLength;
+        if (position > length) {
+            break; // Body still arriving.
+        }
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Refuses a new connection with a 503, without reading from it.
+ * @param server The server.
+ * @param fd The just-accepted socket.
+ */
+void httpShedConnection(Server* server, int fd) {
+    static const char response[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 22\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n"
+        "\r\n{\"error\":\"overloaded\"}";
+
+    // A fresh socket's send buffer is empty, so this doesn't block.
+    send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+    server->shedConnections++;
+}
+
+/**
+ * @brief Describes the server's load (for GET /stats) as JSON.
+ * @param server The server.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ */
+void describeAdmission(Server* server, char* out, size_t room) {
+    int pausedConnections = 0;
+    int deepest = 0;
+    int i;
+
+    for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        HttpClient* client = &server->clients[i];
+        if (client->fd < 0) {
+            continue;
+        }
+        if (client->queued >= HTTP_MAX_PIPELINE || client->inLen == HTTP_BUFFER_SIZE) {
+            pausedConnections++;
+        }
+        if (client->queued > deepest) {
+            deepest = client->queued;
+        }
+    }
+    snprintf(out, room,
+             "{\"connections\":%d,\"max_connections\":%d,"
+             "\"queued_requests\":%d,\"max_queued_requests\":%d,\"peak_queued_requests\":%d,"
+             "\"deepest_connection_queue\":%d,\"max_connection_queue\":%d,"
+             "\"reads_paused\":%s,\"paused_connections\":%d,\"paused_turns\":%lu,"
+             "\"handled_requests\":%lu,\"shed_requests\":%lu,\"shed_connections\":%lu}",
+             server->connections, HTTP_MAX_CLIENTS,
+             server->queuedRequests, HTTP_MAX_QUEUED, server->peakQueued,
+             deepest, HTTP_MAX_PIPELINE,
+             server->readsPaused ? "true" : "false", pausedConnections, server->pausedTurns,
+             server->handledRequests, server->shedRequests, server->shedConnections);
+}
+
+/**
+ * @brief Queues a complete response with a small JSON body.
+ * @param client The connection.
+ * @param status HTTP status line text, e.g. "200 OK".
+ * @param body The JSON body.
+ */
+void httpRespond(HttpClient* client, const char* status, const char* body) {
+    httpRespondAs(client, status, "application/json", body);
+}
+
+/**
+ * @brief Queues a complete response with a small body of any type.
+ * @param client The connection.
+ * @param status HTTP status line text, e.g. "200 OK".
+ * @param type The Content-Type.
+ * @param body The body.
+ */
+void httpRespondAs(HttpClient* client, const char* status, const char* type, const char* body) {
+    int length = snprintf(client->out + client->outLen,
+                          HTTP_BUFFER_SIZE - client->outLen,
+                          "HTTP/1.1 %s\r\n"
+                          "Content-Type: %s\r\n"
+                          "Content-Length: %zu\r\n"
+                          "%s"
+                          "\r\n%s",
+                          status, type, strlen(body),
+                          client->keepAlive ? "" : "Connection: close\r\n",
+                          body);
+    if (length > 0) {
+        client->outLen += (size_t)length;
+    }
+}
+
+/**
+ * @brief Reserves room for a chunk at the end of the output buffer.
+ * Chunk data goes at client->out + client->outLen + HTTP_CHUNK_HEADER;
+ * the chunk-size line is written by httpEndChunk() once the length is known.
+ * @param client The connection.
+ * @return Bytes of chunk data that fit (0 if none).
+ */
+size_t httpBeginChunk(HttpClient* client) {
+    size_t room = HTTP_BUFFER_SIZE - client->outLen;
+    // The size line, the CRLF after the data, and the last-chunk marker,
+    // so a stream can always be ended right after this chunk.
+    size_t overhead = HTTP_CHUNK_HEADER + 2 + 5;
+    return room > overhead ? room - overhead : 0;
+}
+
+/**
+ * @brief Finishes a chunk started with httpBeginChunk().
+ * @param client The connection.
+ * @param length Bytes of chunk data written.
+ * @param last Also end the response with the last-chunk marker.
+ */
+void httpEndChunk(HttpClient* client, size_t length, int last) {
+    char* chunk = client->out + client->outLen;
+    char header[32];
+
+    if (length > 0) {
+        // Chunk size in hex, zero-padded to a fixed width.
+        snprintf(header, sizeof(header), "%06zx\r\n", length);
+        memcpy(chunk, header, HTTP_CHUNK_HEADER);
+        memcpy(chunk + HTTP_CHUNK_HEADER + length, "\r\n", 2);
+        client->outLen += HTTP_CHUNK_HEADER + length + 2;
+    }
+    if (last) {
+        memcpy(client->out + client->outLen, "0\r\n\r\n", 5);
+        client->outLen += 5;
+    }
+}
+
+/**
+ * @brief Fills the output buffer with the next chunk of a streamed listing.
+ * For a plain listing that's part of a JSON array; for a subscription it's
+ * "task" lines, ending with the "ready" line.
+ * @param client The connection, with 'streaming' set.
+ */
+void httpContinueListing(HttpClient* client) {
+    TaskList* list = client->snapshot.list;
+    int lines = (client->subscriber != NULL);
+    size_t room = httpBeginChunk(client);
+    char* data = client->out + client->outLen + HTTP_CHUNK_HEADER;
+    size_t used = 0;
+
+    // Keep room for the closing ']' or "ready" line.
+    if (room < 64) {
+        return;
+    }
+    room -= 48;
+
+    if (client->cursor == NULL && client->index == 0) {
+        if (!lines) {
+            data[used++] = '[';
+        }
+        client->cursor = list->head;
+        client->index = 1;
+    }
+
+    while (client->cursor != NULL) {
+        Task* task = client->cursor;
+        if (isVisible(task, client->snapshot.version)) {
+            if (client->query[0] == '\0' || strstr(task->description, client->query) != NULL) {
+                // Arrays put a comma before each item but the first;
+                // lines put a newline after every item.
+                size_t before = (!lines && client->matches > 0) ? 1 : 0;
+                size_t after = lines ? 1 : 0;
+                size_t wrote = jsonPutTask(data + used + before, room - used - before - after,
+                                           lines ? "task" : NULL, client->index, task);
+                if (wrote == 0) {
+                    break; // Buffer full; resume from this task next time.
+                }
+                if (before) {
+                    data[used] = ',';
+                }
+                used += before + wrote;
+                if (after) {
+                    data[used++] = '\n';
+                }
+                client->matches++;
+            }
+            client->index++;
+        }
+        client->cursor = task->next;
+    }
+
+    if (client->cursor != NULL) {
+        if (used > 0) {
+            httpEndChunk(client, used, 0);
+        }
+        return;
+    }
+
+    // Done with the snapshot.
+    if (lines) {
+        used += (size_t)sprintf(data + used, "{\"type\":\"ready\",\"seq\":%lu}\n",
+                                client->snapshot.version);
+    } else {
+        data[used++] = ']';
+    }
+    httpEndChunk(client, used, !lines);
+    closeSnapshot(&client->snapshot);
+    client->streaming = 0;
+}
+
+/**
+ * @brief Starts a streamed JSON array response for /tasks or /search.
+ * @param client The connection.
+ * @param list The list to read.
+ * @param query Only tasks containing this text are sent ("" = all).
+ */
+void httpStartListing(HttpClient* client, TaskList* list, const char* query) {
+    int length = snprintf(client->out + client->outLen,
+                          HTTP_BUFFER_SIZE - client->outLen,
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: %s\r\n"
+                          "Transfer-Encoding: chunked\r\n"
+                          "%s"
+                          "\r\n",
+                          client->subscriber ? "application/x-ndjson" : "application/json",
+                          client->keepAlive ? "" : "Connection: close\r\n");
+    client->outLen += (size_t)length;
+
+    strncpy(client->query, query, MAX_TASK_LEN - 1);
+    client->query[MAX_TASK_LEN - 1] = '\0';
+    client->snapshot = openSnapshot(list);
+    client->cursor = NULL;
+    client->index = 0;
+    client->matches = 0;
+    client->streaming = 1;
+    if (client->subscriber == NULL) {
+        metricAdd(METRIC_OP_LIST, 1);
+    }
+    httpContinueListing(client);
+}
+
+/**
+ * @brief Starts a GET /subscribe stream.
+ * Subscribing and opening the snapshot happen at the same version, so the
+ * "task" lines plus the change lines after them describe the list exactly.
+ * @param client The connection.
+ * @param list The list to watch.
+ */
+void httpStartSubscription(HttpClient* client, TaskList* list) {
+    client->keepAlive = 0; // The stream only ends when one side closes it.
+    client->subscriber = subscribe(list);
+    httpStartListing(client, list, "");
+}
+
+/**
+ * @brief Fills the output buffer with queued change events.
+ * @param client The connection, with 'subscriber' set.
+ */
+void httpContinueEvents(HttpClient* client) {
+    Subscriber* subscriber = client->subscriber;
+    size_t room = httpBeginChunk(client);
+    char* data = client->out + client->outLen + HTTP_CHUNK_HEADER;
+    size_t used = 0;
+    ChangeEvent* event;
+
+    // Keep room for the "overflow" line.
+    if (room < 64) {
+        return;
+    }
+    room -= 32;
+
+    while ((event = peekChange(subscriber)) != NULL) {
+        size_t wrote = jsonPutChange(data + used, room - used - 1, event);
+        if (wrote == 0) {
+            break; // Buffer full; the rest goes in the next chunk.
+        }
+        used += wrote;
+        data[used++] = '\n';
+        consumeChange(subscriber);
+    }
+
+    if (peekChange(subscriber) == NULL && subscriber->overflowed) {
+        // Changes were dropped, so this mirror can't be kept exact anymore.
+        used += (size_t)sprintf(data + used, "{\"type\":\"overflow\"}\n");
+        httpEndChunk(client, used, 1);
+        unsubscribe(subscriber);
+        client->subscriber = NULL;
+        return;
+    }
+    httpEndChunk(client, used, 0);
+}
+
+/**
+ * @brief Routes one parsed request to the task list.
+ * @param client The connection.
+ * @param server The server (its list, and replication state).
+ * @param method The request method.
+ * @param path The request target (path and query).
+ * @param body The request body (NUL-terminated).
+ */
+void httpDispatch(HttpClient* client, Server* server,
+                  const char* method, char* path, char* body) {
+    TRACE_SPAN("http request");
+    TaskList* list = server->list;
+    char reply[1024];
+    int write = strcmp(method, "GET") != 0;
+
+    if (strcmp(method, "GET") == 0 && strcmp(path, "/stats") == 0) {
+        describeAdmission(server, reply, sizeof(reply));
+        httpRespond(client, "200 OK", reply);
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/metrics") == 0) {
+        char page[METRICS_PAGE_SIZE];
+        writeMetrics(server, page, sizeof(page));
+        httpRespondAs(client, "200 OK", "text/plain; version=0.0.4", page);
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/trace") == 0) {
+        long events = writeTrace(NULL);
+        if (events < 0) {
+            httpRespond(client, "409 Conflict", "{\"error\":\"not tracing (start with --trace FILE)\"}");
+            return;
+        }
+        snprintf(reply, sizeof(reply), "{\"ok\":true,\"events\":%ld}", events);
+        httpRespond(client, "200 OK", reply);
+    } else if (server->shard != NULL &&
+               (strcmp(path, "/replication") == 0 || strcmp(path, "/promote") == 0 ||
+                strstr(path, "/subscribe") != NULL)) {
+        // A subscriber would have to live on the list owner's thread, and
+        // replication is per process.
+        httpRespond(client, "501 Not Implemented", "{\"error\":\"not supported with --threads\"}");
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/replication") == 0) {
+        describeReplication(&server->replication, list, reply, sizeof(reply));
+        httpRespond(client, "200 OK", reply);
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/promote") == 0) {
+        if (server->replication.role != ROLE_FOLLOWER) {
+            httpRespond(client, "409 Conflict", "{\"error\":\"not a follower\"}");
+            return;
+        }
+        // Failover: stop following and start taking writes (and saving).
+        if (server->replication.fd >= 0) {
+            close(server->replication.fd);
+            server->replication.fd = -1;
+        }
+        server->replication.role = ROLE_STANDALONE;
+        printf("Promoted from follower; now accepting writes.\n");
+        httpRespond(client, "200 OK", "{\"ok\":true}");
+    } else if (write && server->replication.role == ROLE_FOLLOWER) {
+        httpRespond(client, "403 Forbidden", "{\"error\":\"read-only follower\"}");
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/workspace") == 0) {
+        describeWorkspace(&server->workspace, reply, sizeof(reply));
+        httpRespond(client, "200 OK", reply);
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/lists") == 0) {
+        httpListLists(client, &server->workspace);
+    } else if (strncmp(path, "/lists/", 7) == 0) {
+        // /lists/NAME/... is the same as /... on the list called NAME.
+        char name[LIST_NAME_MAX];
+        size_t length = strcspn(path + 7, "/");
+        if (length >= LIST_NAME_MAX || path[7 + length] != '/') {
+            httpRespond(client, "404 Not Found", "{\"error\":\"no such route\"}");
+            return;
+        }
+        memcpy(name, path + 7, length);
+        name[length] = '\0';
+        if (!validListName(name)) {
+            httpRespond(client, "400 Bad Request", "{\"error\":\"bad list name\"}");
+            return;
+        }
+        if (server->shard != NULL &&
+            shardOf(name, server->shard->group->count) != server->shard->index) {
+            httpForward(client, server, name, method, path + 7 + length, body);
+            return;
+        }
+        TaskList* named = workspaceOpen(&server->workspace, name);
+        httpDispatchList(client, server, named, method, path + 7 + length, body);
+        workspaceTouch(&server->workspace, workspaceFind(&server->workspace, name, 0));
+    } else if (list == NULL) {
+        // A shard that doesn't own "tasks".
+        httpForward(client, server, "tasks", method, path, body);
+    } else {
+        httpDispatchList(client, server, list, method, path, body);
+        workspaceTouch(&server->workspace, server->workspace.mainEntry);
+    }
+}
+
+/**
+ * @brief Routes a request for one list's tasks.
+ * @param client The connection.
+ * @param server The server.
+ * @param list The list the request is for.
+ * @param method The request method.
+ * @param path The request target, less any /lists/NAME prefix.
+ * @param body The request body (NUL-terminated).
+ */
+void httpDispatchList(HttpClient* client, Server* server, TaskList* list,
+                      const char* method, char* path, char* body) {
+    char reply[64];
+    int index = 0;
+    int consumed = 0;
+
+    if (strcmp(method, "GET") == 0 && strcmp(path, "/tasks") == 0) {
+        httpStartListing(client, list, "");
+    } else if (strcmp(method, "GET") == 0 && strncmp(path, "/search?q=", 10) == 0) {
+        urlDecode(path + 10);
+        httpStartListing(client, list, path + 10);
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/tasks") == 0) {
+        body[strcspn(body, "\r\n")] = '\0';
+        if (body[0] == '\0') {
+            httpRespond(client, "400 Bad Request", "{\"error\":\"empty description\"}");
+            return;
+        }
+        addTask(list, body);
+        snprintf(reply, sizeof(reply), "{\"index\":%d,\"id\":%lu}",
+                 list->count, list->tail->id);
+        httpRespond(client, "201 Created", reply);
+    } else if (strcmp(method, "POST") == 0 &&
+               sscanf(path, "/tasks/%d/complete%n", &index, &consumed) == 1 &&
+               path[consumed] == '\0') {
+        if (completeTask(list, index) != 0) {
+            httpRespond(client, "404 Not Found", "{\"error\":\"no such task\"}");
+        } else {
+            httpRespond(client, "200 OK", "{\"ok\":true}");
+        }
+    } else if (strcmp(method, "DELETE") == 0 &&
+               sscanf(path, "/tasks/%d%n", &index, &consumed) == 1 &&
+               path[consumed] == '\0') {
+        if (removeTask(list, index) != 0) {
+            httpRespond(client, "404 Not Found", "{\"error\":\"no such task\"}");
+        } else {
+            httpRespond(client, "200 OK", "{\"ok\":true}");
+        }
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/subscribe") == 0) {
+        httpStartSubscription(client, list);
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/save") == 0) {
+        if (server->executor.eventFd >= 0) {
+            saveTasksAsync(&server->executor, list, client); // Replies once it's on disk.
+        } else {
+            saveTasks(list);
+            httpRespond(client, "200 OK", "{\"ok\":true}");
+        }
+    } else {
+        httpRespond(client, "404 Not Found", "{\"error\":\"no such route\"}");
+    }
+}
+
+/**
+ * @brief Parses and handles the next buffered request, if complete.
+ * @param client The connection.
+ * @param server The server.
+ * @return 1 if a request was handled, 0 if more input is needed,
+ * -1 if the connection should be closed.
+ */
+int httpHandleRequest(HttpClient* client, Server* server) {
+    char method[8];
+    char path[HTTP_MAX_PATH];
+    char body[HTTP_MAX_BODY + 1];
+    char* headerEnd;
+    char* line;
+    size_t contentLength = 0;
+    size_t headerLength;
+
+    client->in[client->inLen] = '\0';
+    headerEnd = strstr(client->in, "\r\n\r\n");
+    if (headerEnd == NULL) {
+        if (client->inLen == HTTP_BUFFER_SIZE) {
+            return -1; // Headers larger than our buffer.
+        }
+        return 0;
+    }
+    headerLength = (size_t)(headerEnd - client->in) + 4;
+
+    if (sscanf(client->in, "%7s %255s HTTP/1.%*d", method, path) != 2) {
+        return -1;
+    }
+    client->keepAlive = strstr(client->in, "HTTP/1.0\r\n") == NULL;
+
+    // Look at the headers we care about.
+    for (line = strstr(client->in, "\r\n") + 2; line < headerEnd;
+         line = strstr(line, "\r\n") + 2) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = strtoul(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char* value = line + 11;
+            while (*value == ' ') {
+                value++;
+            }
+            if (strncasecmp(value, "close", 5) == 0) {
+                client->keepAlive = 0;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                client->keepAlive = 1;
+            }
+        }
+    }
+
+    if (contentLength > HTTP_MAX_BODY) {
+        client->keepAlive = 0;
+        httpRespond(client, "413 Payload Too Large", "{\"error\":\"body too large\"}");
+        return -1;
+    }
+    if (headerLength + contentLength > HTTP_BUFFER_SIZE) {
+        return -1; // Can never fit in our buffer.
+    }
+    if (client->inLen < headerLength + contentLength) {
+        return 0; // Wait for the rest of the body.
+    }
+    memcpy(body, client->in + headerLength, contentLength);
+    body[contentLength] = '\0';
+
+    // Drop the request from the input buffer; pipelined ones move up.
+    client->inLen -= headerLength + contentLength;
+    memmove(client->in, client->in + headerLength + contentLength, client->inLen);
+    int waited = 0; // Milliseconds spent queued
+    int refused = 0;
+    if (client->queued > 0) {
+        client->queued--;
+        server->queuedRequests--;
+        waited = (int)((nowNanos() - client->queuedSince) / 1000000LL);
+    } else if (client->refused > 0) {
+        client->refused--;
+        refused = 1;
+    }
+
+    // Load shedding: a request that arrived to full queues, or has waited
+    // so long it would only make the ones behind it late too. Refusing it
+    // is cheap; running it isn't.
+    if (refused || waited > HTTP_QUEUE_DEADLINE_MS) {
+        server->shedRequests++;
+        metricAdd(METRIC_HTTP_SHED, 1);
+        httpRespond(client, "503 Service Unavailable", "{\"error\":\"overloaded\"}");
+        return 1;
+    }
+    server->handledRequests++;
+    metricAdd(METRIC_HTTP_HANDLED, 1);
+    httpDispatch(client, server, method, path, body);
+    return 1;
+}
+
+/**
+ * @brief Sends buffered output, produces more of a streamed listing,
+ * and handles pipelined requests, until the connection would block
+ * or has had its turn (HTTP_REQUEST_BUDGET requests).
+ * @param client The connection.
+ * @param server The server.
+ * @return 0 to keep the connection, -1 to close it.
+ */
+int httpPump(HttpClient* client, Server* server) {
+    int budget = HTTP_REQUEST_BUDGET; // So one busy connection can't starve the rest
+
+    while (1) {
+        // 1. Flush what we have.
+        while (client->outSent < client->outLen) {
+            ssize_t sent = send(client->fd, client->out + client->outSent,
+                                client->outLen - client->outSent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0; // Wait for POLLOUT.
+                }
+                return -1;
+            }
+            client->outSent += (size_t)sent;
+        }
+        client->outLen = 0;
+        client->outSent = 0;
+
+        // An async job or another shard owes this connection a response;
+        // wait for it.
+        if (client->job != NULL || client->forwarded) {
+            return 0;
+        }
+
+        // 2. Keep streaming a listing in progress, then any changes
+        //    for a subscriber.
+        if (client->streaming) {
+            httpContinueListing(client);
+            continue;
+        }
+        if (client->subscriber != NULL) {
+            client->inLen = 0; // Subscribers only listen; ignore input.
+            if (peekChange(client->subscriber) == NULL && !client->subscriber->overflowed) {
+                return 0; // Wait for the next change.
+            }
+            httpContinueEvents(client);
+            continue;
+        }
+        if (!client->keepAlive) {
+            return -1; // Response done and the client asked us to close.
+        }
+
+        // 3. Start the next request, if one has arrived. While handing off
+        //    to a new process the list is frozen; the request waits for it.
+        if (server->handoffPhase != HANDOFF_NONE || budget-- == 0) {
+            return 0;
+        }
+        int handled = httpHandleRequest(client, server);
+        if (handled < 0) {
+            client->keepAlive = 0;
+            if (client->outLen > 0) {
+                continue; // Send the error, then close.
+            }
+            return -1;
+        }
+        if (handled == 0) {
+            return 0; // Wait for more input.
+        }
+    }
+}
+
+/**
+ * @brief Accepts every waiting connection, shedding those there's no room for.
+ * @param server The server.
+ */
+void httpAcceptClients(Server* server) {
+    int fd;
+    int i;
+
+    while ((fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        for (i = 0; i < HTTP_MAX_CLIENTS && server->clients[i].fd >= 0; i++) {
+        }
+        if (i == HTTP_MAX_CLIENTS || server->queuedRequests >= HTTP_MAX_QUEUED) {
+            httpShedConnection(server, fd);
+            continue;
+        }
+        server->clients[i].fd = fd;
+        server->clients[i].keepAlive = 1;
+        server->clients[i].generation = ++server->generations;
+        server->connections++;
+    }
+}
+
+/**
+ * @brief Works out what to poll() a connection for.
+ * @param server The server.
+ * @param client The connection.
+ * @param frozen The list is frozen for a handoff.
+ * @return POLLIN, POLLOUT, or 0.
+ */
+short httpClientEvents(const Server* server, const HttpClient* client, int frozen) {
+    // Backpressure: stop reading a connection whose queue is full, or
+    // all of them when the server is behind. Unread requests then
+    // wait in the kernel, and eventually in the client.
+    // (Frozen: new requests wait for the new process.)
+    short events = (frozen || server->readsPaused ||
+                    client->queued >= HTTP_MAX_PIPELINE || client->refused > 0 ||
+                    client->inLen == HTTP_BUFFER_SIZE) ? 0 : POLLIN;
+    if (client->outLen > client->outSent || client->streaming ||
+        (client->subscriber != NULL &&
+         (peekChange(client->subscriber) != NULL || client->subscriber->overflowed))) {
+        events = POLLOUT;
+    }
+    return events;
+}
+
+/**
+ * @brief Reads what a connection sent, runs what it can, and sends the
+ * responses; closes the connection on error or when it's done.
+ * @param server The server.
+ * @param client The connection.
+ * @param revents What poll() reported for it.
+ */
+void httpServiceClient(Server* server, HttpClient* client, short revents) {
+    if (revents & POLLIN) {
+        ssize_t got = recv(client->fd, client->in + client->inLen,
+                           HTTP_BUFFER_SIZE - client->inLen, 0);
+        if (got <= 0) {
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            httpCloseClient(server, client); // Peer closed or error.
+            return;
+        }
+        client->inLen += (size_t)got;
+
+        httpAdmitRequests(server, client);
+    } else if (revents & (POLLERR | POLLHUP)) {
+        httpCloseClient(server, client);
+        return;
+    }
+    if (httpPump(client, server) != 0) {
+        httpCloseClient(server, client);
+    }
+}
+
+/**
+ * @brief Runs the HTTP server until SIGINT/SIGTERM, then saves the list
+ * (unless this process is a follower, whose leader owns the file).
+ * On SIGHUP it hands everything to a new copy of itself and exits instead.
+ * @param list The list to serve (empty when taking over).
+ * @param options The port, the replication role and socket, and the
+ * handoff socket when taking over from a restarting server.
+ * @return 0 on clean shutdown, 1 if a socket couldn't be opened.
+ */
+int runServer(TaskList* list, const Options* options) {
+    static Server server; // Large (per-connection buffers), so not on the stack
+    Replication* replication = &server.replication;
+    struct pollfd fds[HTTP_MAX_CLIENTS + REPL_MAX_FOLLOWERS + 5];
+    int slots[HTTP_MAX_CLIENTS + REPL_MAX_FOLLOWERS + 5];
+    int inherited = -1; // Replication listener from a restarting leader
+    int i;
+
+    server.list = list;
+    workspaceInit(&server.workspace, list, (size_t)options->memoryBudgetMB << 20);
+    server.handoffPhase = HANDOFF_NONE;
+    server.handoffFd = -1;
+    if (options->takeoverFd >= 0) {
+        if (takeOverServer(&server, options->takeoverFd, &inherited) != 0) {
+            return 1;
+        }
+    } else {
+        server.listener = openListener(options->servePort, 0);
+        if (server.listener < 0) {
+            printf("Error: Could not listen on 127.0.0.1:%d (%s).\n",
+                   options->servePort, strerror(errno));
+            return 1;
+        }
+    }
+    for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        memset(&server.clients[i], 0, sizeof(server.clients[i]));
+        server.clients[i].fd = -1;
+    }
+
+    memset(replication, 0, sizeof(*replication));
+    replication->fd = -1;
+    for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        replication->followers[i].fd = -1;
+    }
+    if (options->replicatePath != NULL) {
+        replication->role = ROLE_LEADER;
+        replication->path = options->replicatePath;
+        replication->fd = inherited >= 0 ? inherited : openReplicationListener(replication->path);
+        inherited = -1;
+        if (replication->fd < 0) {
+            printf("Error: Could not listen on %s (%s).\n", replication->path, strerror(errno));
+            close(server.listener);
+            return 1;
+        }
+        printf("Replicating to followers on %s\n", replication->path);
+    } else if (options->followPath != NULL) {
+        replication->role = ROLE_FOLLOWER;
+        replication->path = options->followPath;
+        connectToLeader(replication); // Retried below if the leader isn't up yet.
+    }
+    if (inherited >= 0) {
+        close(inherited);
+    }
+
+    // A follower's tasks.txt belongs to its leader; don't reload from it.
+    server.watchFd = (replication->role == ROLE_FOLLOWER) ? -1 : watchTasksFile();
+    if (options->takeoverFd >= 0 && server.watchFd >= 0) {
+        syncTasksFile(list); // Edits made while the old process was handing off.
+    }
+
+    if (executorStart(&server.executor) != 0) {
+        printf("Warning: Could not start the async worker; saves will block.\n");
+    }
+
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    signal(SIGHUP, requestRestart);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Serving tasks on http://127.0.0.1:%d/ (Ctrl-C to stop)\n", options->servePort);
+    fflush(stdout);
+
+    while (!stopRequested) {
+        int count = 0;
+        int timeout = -1;
+        int frozen;
+
+        // A restart waits for async jobs (saves) to finish.
+        if (restartRequested && server.executor.jobs == NULL) {
+            restartRequested = 0;
+            if (server.handoffPhase == HANDOFF_NONE) {
+                startHandoff(&server, options);
+            }
+        }
+        // While handing off, nothing may change the list.
+        frozen = (server.handoffPhase != HANDOFF_NONE);
+
+        // Watch the listener, the task file, the replication socket, the
+        // handoff socket, and each follower and client for input or output space.
+        // Admission control: with every slot taken, or too much queued,
+        // leave new connections waiting in the kernel's accept queue.
+        fds[count].fd = (frozen || server.connections == HTTP_MAX_CLIENTS || server.readsPaused)
+                            ? -1 : server.listener;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        // Not while saving: our own rename would look like an external edit.
+        fds[count].fd = (frozen || server.executor.saving != NULL)
+                            ? -1 : server.watchFd; // Negative fds are ignored by poll()
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        fds[count].fd = frozen ? -1 : replication->fd;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        fds[count].fd = server.handoffFd;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        fds[count].fd = server.executor.eventFd;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+            Follower* follower = &replication->followers[i];
+            if (follower->fd < 0) {
+                continue;
+            }
+            fds[count].fd = follower->fd;
+            fds[count].events = followerHasOutput(follower) ? POLLOUT : POLLIN;
+            slots[count++] = -2 - i;
+        }
+        for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+            HttpClient* client = &server.clients[i];
+            if (client->fd < 0) {
+                continue;
+            }
+            fds[count].fd = client->fd;
+            fds[count].events = httpClientEvents(&server, client, frozen);
+            slots[count++] = i;
+            // Requests we already hold don't make poll() return; don't wait.
+            if (client->queued + client->refused > 0 && client->outLen == client->outSent &&
+                !frozen) {
+                timeout = 0;
+            }
+        }
+
+        // Wake up for heartbeats, and for retrying a lost leader.
+        if (replication->role == ROLE_LEADER) {
+            timeout = REPL_HEARTBEAT_MS;
+        } else if (replication->role == ROLE_FOLLOWER && replication->fd < 0) {
+            timeout = 1000;
+        }
+        if (frozen && timeout != 0) {
+            timeout = REPL_HEARTBEAT_MS;
+        }
+        if (server.executor.eventFd >= 0 && executorReady(&server.executor) > 0) {
+            timeout = 0; // A job can carry on right away.
+        }
+
+        if (poll(fds, count, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // New connections.
+        if (fds[0].revents & POLLIN) {
+            httpAcceptClients(&server);
+        }
+
+        // Edits to tasks.txt by other programs.
+        if (fds[1].revents & POLLIN) {
+            workspaceReloadChanged(&server.workspace, server.watchFd);
+        }
+
+        // Replication: new followers, or the leader's stream.
+        if (replication->role == ROLE_LEADER && (fds[2].revents & POLLIN)) {
+            int fd;
+            while ((fd = accept4(replication->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                for (i = 0; i < REPL_MAX_FOLLOWERS && replication->followers[i].fd >= 0; i++) {
+                }
+                if (i == REPL_MAX_FOLLOWERS) {
+                    close(fd); // Too many followers.
+                    continue;
+                }
+                replication->followers[i].fd = fd;
+                startFollowerSnapshot(&replication->followers[i], list);
+                printf("Follower connected; sending snapshot at version %lu.\n", list->version);
+            }
+        } else if (replication->role == ROLE_FOLLOWER && !frozen) {
+            if (replication->fd >= 0 && (fds[2].revents & (POLLIN | POLLHUP | POLLERR))) {
+                readFromLeader(replication, list);
+            } else if (replication->fd < 0 &&
+                       nowNanos() - replication->lastConnectAttempt > 1000000000LL) {
+                connectToLeader(replication);
+            }
+        }
+
+        // The "ready" from a new process, or connections from an old one.
+        if (fds[3].revents != 0) {
+            serviceHandoff(&server);
+        }
+
+        // Async jobs whose calls finished, or that can carry on.
+        if (server.executor.eventFd >= 0 &&
+            (fds[4].revents != 0 || executorReady(&server.executor) > 0)) {
+            executorRun(&server.executor);
+        }
+
+        // Existing connections.
+        for (i = 5; i < count; i++) {
+            if (slots[i] <= -2) {
+                continue; // Followers are serviced below, after any writes.
+            }
+            HttpClient* client = &server.clients[slots[i]];
+            if (fds[i].revents == 0 && (client->queued + client->refused == 0 || frozen)) {
+                continue;
+            }
+            httpServiceClient(&server, client, fds[i].revents);
+        }
+
+        // Drop lists nobody has used lately if we're over the memory budget.
+        if (server.workspace.loadedBytes > server.workspace.budget) {
+            workspaceEnforceBudget(&server.workspace);
+        }
+
+        // Pause reading everywhere while too much is queued; resume at half.
+        if (server.queuedRequests >= HTTP_MAX_QUEUED) {
+            server.readsPaused = 1;
+        } else if (server.queuedRequests <= HTTP_MAX_QUEUED / 2) {
+            server.readsPaused = 0;
+        }
+        if (server.readsPaused) {
+            server.pausedTurns++;
+        }
+
+        // Ship what changed to the followers.
+        if (replication->role == ROLE_LEADER) {
+            if (nowNanos() - replication->lastHeartbeat >= REPL_HEARTBEAT_MS * 1000000LL) {
+                sendHeartbeats(replication, list);
+            }
+            for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+                Follower* follower = &replication->followers[i];
+                char scratch[256];
+                if (follower->fd < 0) {
+                    continue;
+                }
+                // Followers never send; a readable socket means it closed.
+                if (recv(follower->fd, scratch, sizeof(scratch), MSG_DONTWAIT) == 0) {
+                    dropFollower(follower);
+                    continue;
+                }
+                fillFollower(follower, list);
+                if (flushFollower(follower) != 0) {
+                    dropFollower(follower);
+                }
+            }
+        }
+
+        // Pass idle connections to the new process; done once none are left.
+        if (server.handoffPhase == HANDOFF_DRAINING && handOffClients(&server) == 0) {
+            break;
+        }
+    }
+
+    for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        if (server.clients[i].fd >= 0) {
+            httpReset(&server.clients[i]);
+        }
+    }
+    executorStop(&server.executor); // Lets a save in progress finish.
+    workspaceClose(&server.workspace); // Saves the other lists.
+    for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        if (replication->followers[i].fd >= 0) {
+            dropFollower(&replication->followers[i]);
+        }
+    }
+    if (replication->fd >= 0) {
+        close(replication->fd);
+    }
+    if (server.listener >= 0) {
+        close(server.listener);
+    }
+    if (server.watchFd >= 0) {
+        close(server.watchFd);
+    }
+    if (server.handoffFd >= 0) {
+        close(server.handoffFd); // Tells the new process it has everything.
+    }
+
+    if (server.handoffPhase == HANDOFF_DRAINING) {
+        // The new process owns the list, the sockets and the file now.
+        printf("Handed off to process %d.\n", (int)server.successor);
+        return 0;
+    }
+    if (replication->role == ROLE_LEADER) {
+        unlink(replication->path);
+    }
+    printf("\nServer stopped.\n");
+
+    if (replication->role != ROLE_FOLLOWER) {
+        saveTasks(list);
+    }
+    return 0;
+}
+
+// --- HTTP Load Generator ---
+
+/**
+ * @brief Compares two long longs for qsort().
+ */
+int compareLongLong(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Consumes response bytes and reports when a response is complete.
+ * Understands Content-Length and chunked bodies; it only keeps the last few
+ * bytes seen, so it can follow arbitrarily large listings. With one request
+ * in flight per connection, a read never spans two responses.
+ * @param conn The load-generator connection.
+ * @param data Received bytes.
+ * @param length Number of received bytes.
+ * @return 1 if the response finished within 'data', 0 otherwise.
+ */
+int benchConsume(BenchConnection* conn, const char* data, size_t length) {
+    size_t i = 0;
+
+    // Collect the header one byte at a time (it is short).
+    while (!conn->headerDone && i < length) {
+        char c = data[i++];
+        if (conn->headerLen < sizeof(conn->header) - 1) {
+            conn->header[conn->headerLen++] = c;
+            conn->header[conn->headerLen] = '\0';
+        }
+        if (conn->headerLen >= 4 &&
+            memcmp(conn->header + conn->headerLen - 4, "\r\n\r\n", 4) == 0) {
+            char* value = strcasestr(conn->header, "Content-Length:");
+            conn->headerDone = 1;
+            conn->chunked = strcasestr(conn->header, "Transfer-Encoding: chunked") != NULL;
+            conn->remaining = value ? strtol(value + 15, NULL, 10) : 0;
+            memset(conn->tail, 0, sizeof(conn->tail));
+        }
+    }
+    if (!conn->headerDone) {
+        return 0;
+    }
+
+    // Skip over the body in bulk.
+    length -= i;
+    data += i;
+    if (conn->chunked) {
+        // Slide the last bytes seen into 'tail' and look for the final chunk.
+        size_t keep = sizeof(conn->tail);
+        if (length >= keep) {
+            memcpy(conn->tail, data + length - keep, keep);
+        } else {
+            memmove(conn->tail, conn->tail + length, keep - length);
+            memcpy(conn->tail + keep - length, data, length);
+        }
+        if (memcmp(conn->tail, "\n0\r\n\r\n", keep) != 0) {
+            return 0;
+        }
+    } else {
+        conn->remaining -= (long)length;
+        if (conn->remaining > 0) {
+            return 0;
+        }
+    }
+    conn->headerDone = 0;
+    conn->headerLen = 0;
+    return 1;
+}
+
+/**
+ * @brief Drives GETs over keep-alive connections and reports
+ * throughput and latency percentiles.
+ * @param port The server's port on 127.0.0.1.
+ * @param connections Number of concurrent connections.
+ * @param requests Total number of requests to send.
+ * @param path What to GET (NULL = /tasks). A "%d" in it becomes the
+ * connection's number, so e.g. /lists/l%d/tasks spreads the load over
+ * as many lists as connections.
+ * @return 0 on success, 1 on error.
+ */
+int runHttpBench(int port, int connections, long requests, const char* path) {
+    struct sockaddr_in address;
+    char (*requestText)[HTTP_MAX_PATH + 64];
+    int* requestLength;
+    BenchConnection* conns;
+    struct pollfd* fds;
+    long long* latencies;
+    long sent = 0;
+    long done = 0;
+    int i;
+
+    if (connections < 1 || requests < 1) {
+        printf("Error: Need at least one connection and one request.\n");
+        return 1;
+    }
+    conns = (BenchConnection*)calloc((size_t)connections, sizeof(BenchConnection));
+    fds = (struct pollfd*)calloc((size_t)connections, sizeof(struct pollfd));
+    latencies = (long long*)malloc((size_t)requests * sizeof(long long));
+    requestText = (char (*)[HTTP_MAX_PATH + 64])malloc((size_t)connections * sizeof(*requestText));
+    requestLength = (int*)malloc((size_t)connections * sizeof(int));
+    if (conns == NULL || fds == NULL || latencies == NULL ||
+        requestText == NULL || requestLength == NULL) {
+        printf("Error: Could not allocate memory for the benchmark.\n");
+        exit(1);
+    }
+    if (path == NULL) {
+        path = "/tasks";
+    }
+    if (strlen(path) >= HTTP_MAX_PATH - 16) {
+        printf("Error: Path too long.\n");
+        return 1;
+    }
+    for (i = 0; i < connections; i++) {
+        const char* number = strstr(path, "%d");
+        requestLength[i] = number == NULL
+            ? snprintf(requestText[i], sizeof(requestText[i]),
+                       "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path)
+            : snprintf(requestText[i], sizeof(requestText[i]),
+                       "GET %.*s%d%s HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                       (int)(number - path), path, i, number + 2);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (i = 0; i < connections; i++) {
+        int yes = 1;
+        conns[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conns[i].fd < 0 ||
+            connect(conns[i].fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            printf("Error: Could not connect to 127.0.0.1:%d (%s).\n", port, strerror(errno));
+            return 1;
+        }
+        setsockopt(conns[i].fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        fds[i].fd = conns[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    long long start = nowNanos();
+
+    // Closed loop: each connection has one request in flight at a time.
+    for (i = 0; i < connections && sent < requests; i++, sent++) {
+        conns[i].sentAt = nowNanos();
+        send(conns[i].fd, requestText[i], (size_t)requestLength[i], MSG_NOSIGNAL);
+    }
+    while (done < requests) {
+        if (poll(fds, connections, 5000) <= 0) {
+            printf("Error: Server stopped responding.\n");
+            break;
+        }
+        for (i = 0; i < connections; i++) {
+            char data[16384];
+            ssize_t got;
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            got = recv(conns[i].fd, data, sizeof(data), 0);
+            if (got <= 0) {
+                printf("Error: Connection closed by server.\n");
+                done = requests;
+                break;
+            }
+            if (benchConsume(&conns[i], data, (size_t)got)) {
+                latencies[done++] = nowNanos() - conns[i].sentAt;
+                if (sent < requests) {
+                    conns[i].sentAt = nowNanos();
+                    send(conns[i].fd, requestText[i], (size_t)requestLength[i], MSG_NOSIGNAL);
+                    sent++;
+                }
+            }
+        }
+    }
+
+    long long elapsed = nowNanos() - start;
+    qsort(latencies, (size_t)done, sizeof(long long), compareLongLong);
+    if (done > 0) {
+        printf("requests=%ld connections=%d seconds=%.3f req_per_sec=%.0f "
+               "p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+               done, connections, elapsed / 1e9, done / (elapsed / 1e9),
+               latencies[done / 2] / 1e3, latencies[(done * 99) / 100] / 1e3,
+               latencies[done - 1] / 1e3);
+    }
+
+    for (i = 0; i < connections; i++) {
+        close(conns[i].fd);
+    }
+    free(conns);
+    free(fds);
+    free(latencies);
+    free(requestText);
+    free(requestLength);
+    return 0;
+}
+
+// --- Replication ---
+//
+// A leader (--serve PORT --replicate PATH) ships its change log to hot
+// standby followers (--serve PORT --follow PATH) over a Unix socket. The
+// stream is plain text, one message per line:
+//
+//   S <version>                      start of a full snapshot
+//   T <id> <completed> <text>        one task of the snapshot
+//   R <version>                      end of the snapshot
+//   A <seq> <index> <id> <text>      task added at <index>
+//   M <seq> <index> <id>             task at <index> marked complete
+//   D <seq> <index> <id>             task at <index> deleted
+//   H <version> <nanos>              heartbeat: leader's version and clock
+//
+// The change lines come from a Subscriber, so a follower that falls more
+// than SUBSCRIBER_RING_SIZE changes behind doesn't stall the leader; it
+// is sent a fresh snapshot instead and catches up from there. Followers
+// serve reads over HTTP and reject writes until promoted.
+
+/**
+ * @brief Creates a non-blocking Unix socket listening at a path.
+ * @param path The socket's path (an old socket file there is replaced).
+ * @return The socket, or -1 on error.
+ */
+int openReplicationListener(const char* path) {
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(fd, REPL_MAX_FOLLOWERS) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Connects a follower to its leader's Unix socket.
+ * @param replication The follower's replication state.
+ * @return 0 on success, -1 if the leader isn't reachable (yet).
+ */
+int connectToLeader(Replication* replication) {
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    replication->lastConnectAttempt = nowNanos();
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, replication->path, sizeof(address.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    replication->fd = fd;
+    replication->inLen = 0;
+    printf("Following leader at %s.\n", replication->path);
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * @brief Starts (or restarts) sending a full snapshot to a follower.
+ * The subscription and the snapshot start at the same version, so the
+ * snapshot plus the changes queued after it are exactly the leader's list.
+ * @param follower The follower.
+ * @param list The leader's list.
+ */
+void startFollowerSnapshot(Follower* follower, TaskList* list) {
+    if (follower->subscriber != NULL) {
+        unsubscribe(follower->subscriber);
+    }
+    follower->subscriber = subscribe(list);
+    follower->snapshot = openSnapshot(list);
+    follower->sendingSnapshot = 1;
+    follower->cursor = firstVisible(list->head, follower->snapshot.version);
+    follower->snapshotsSent++;
+    follower->outLen += (size_t)sprintf(follower->out + follower->outLen, "S %lu\n",
+                                        follower->snapshot.version);
+}
+
+/**
+ * @brief Fills a follower's output buffer with snapshot or change lines.
+ * @param follower The follower.
+ * @param list The leader's list.
+ */
+void fillFollower(Follower* follower, TaskList* list) {
+    // Room for the longest line: a prefix, numbers and a full description.
+    const size_t longest = MAX_TASK_LEN + 96;
+
+    while (REPL_BUFFER_SIZE - follower->outLen > longest) {
+        char* out = follower->out + follower->outLen;
+
+        if (follower->sendingSnapshot) {
+            Task* task = follower->cursor;
+            if (task == NULL) {
+                follower->outLen += (size_t)sprintf(out, "R %lu\n", follower->snapshot.version);
+                follower->sentVersion = follower->snapshot.version;
+                closeSnapshot(&follower->snapshot);
+                follower->sendingSnapshot = 0;
+                continue;
+            }
+            follower->outLen += (size_t)sprintf(out, "T %lu %d %s\n", task->id,
+                                                task->completed, task->description);
+            // The cursor may wait here until the next call: keep it on a
+            // record our snapshot keeps alive.
+            follower->cursor = firstVisible(task->next, follower->snapshot.version);
+            continue;
+        }
+
+        ChangeEvent* event = peekChange(follower->subscriber);
+        if (event == NULL) {
+            if (follower->subscriber->overflowed) {
+                // Too far behind to replay the log; catch up from a snapshot.
+                startFollowerSnapshot(follower, list);
+                continue;
+            }
+            break;
+        }
+        if (event->type == CHANGE_ADD) {
+            follower->outLen += (size_t)sprintf(out, "A %lu %d %lu %s\n", event->sequence,
+                                                event->index, event->id, event->description);
+        } else {
+            follower->outLen += (size_t)sprintf(out, "%c %lu %d %lu\n",
+                                                event->type == CHANGE_MARK ? 'M' : 'D',
+                                                event->sequence, event->index, event->id);
+        }
+        follower->sentVersion = event->sequence;
+        consumeChange(follower->subscriber);
+    }
+}
+
+/**
+ * @brief Sends a follower's buffered lines without blocking.
+ * @param follower The follower.
+ * @return 0 to keep the follower, -1 if the connection failed.
+ */
+int flushFollower(Follower* follower) {
+    while (follower->outSent < follower->outLen) {
+        ssize_t sent = send(follower->fd, follower->out + follower->outSent,
+                            follower->outLen - follower->outSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        follower->outSent += (size_t)sent;
+    }
+    follower->outLen = 0;
+    follower->outSent = 0;
+    return 0;
+}
+
+/**
+ * @brief Tells whether a follower has anything to send.
+ * @param follower The follower.
+ * @return 1 if there are buffered bytes, snapshot records or changes.
+ */
+int followerHasOutput(Follower* follower) {
+    return follower->outLen > follower->outSent || follower->sendingSnapshot ||
+           peekChange(follower->subscriber) != NULL || follower->subscriber->overflowed;
+}
+
+/**
+ * @brief Disconnects a follower and frees its slot.
+ * @param follower The follower.
+ */
+void dropFollower(Follower* follower) {
+    if (follower->sendingSnapshot) {
+        closeSnapshot(&follower->snapshot);
+    }
+    if (follower->subscriber != NULL) {
+        unsubscribe(follower->subscriber);
+    }
+    close(follower->fd);
+    memset(follower, 0, sizeof(*follower));
+    follower->fd = -1;
+}
+
+/**
+ * @brief Queues a heartbeat for every follower that's caught up enough
+ * to have room, so followers can measure their lag even when idle.
+ * @param replication The leader's replication state.
+ * @param list The leader's list.
+ */
+void sendHeartbeats(Replication* replication, TaskList* list) {
+    int i;
+    replication->lastHeartbeat = nowNanos();
+    for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        Follower* follower = &replication->followers[i];
+        if (follower->fd >= 0 && REPL_BUFFER_SIZE - follower->outLen > 64) {
+            follower->outLen += (size_t)sprintf(follower->out + follower->outLen, "H %lu %lld\n",
+                                                list->version, replication->lastHeartbeat);
+        }
+    }
+}
+
+/**
+ * @brief Applies one line of the leader's stream to a follower's list.
+ * @param replication The follower's replication state.
+ * @param list The follower's list.
+ * @param line The line, without its newline.
+ */
+void applyReplicationLine(Replication* replication, TaskList* list, char* line) {
+    unsigned long version = 0;
+    unsigned long id = 0;
+    long long sentAt = 0;
+    int index = 0;
+    int completed = 0;
+    int consumed = 0;
+
+    switch (line[0]) {
+        case 'S': // Full snapshot follows: start from an empty list.
+            while (list->count > 0) {
+                removeTask(list, 1);
+            }
+            replication->snapshotsLoaded++;
+            break;
+
+        case 'T':
+            if (sscanf(line, "T %lu %d%n", &id, &completed, &consumed) == 2 &&
+                line[consumed] == ' ') {
+                // The leader's id goes on before the add is published,
+                // so this list's subscribers see it too.
+                Task* task = createTask(line + consumed + 1);
+                task->id = id;
+                linkTask(list, task);
+                if (completed) {
+                    // Just linked, so no snapshot can see it yet: set it
+                    // in place rather than walking to it.
+                    task->completed = 1;
+                    list->done++;
+                    publishChange(list, CHANGE_MARK, list->count, task);
+                }
+            }
+            break;
+
+        case 'R':
+            sscanf(line, "R %lu", &version);
+            replication->appliedVersion = version;
+            break;
+
+        case 'A':
+            if (sscanf(line, "A %lu %d %lu%n", &version, &index, &id, &consumed) == 3 &&
+                line[consumed] == ' ') {
+                Task* task = createTask(line + consumed + 1);
+                task->id = id;
+                linkTaskAt(list, index, task);
+            }
+            replication->appliedVersion = version;
+            break;
+
+        case 'M':
+        case 'D':
+            if (sscanf(line + 1, " %lu %d %lu", &version, &index, &id) == 3) {
+                if (line[0] == 'M') {
+                    completeTask(list, index);
+                } else {
+                    removeTask(list, index);
+                }
+            }
+            replication->appliedVersion = version;
+            break;
+
+        case 'H':
+            if (sscanf(line, "H %lu %lld", &version, &sentAt) == 2) {
+                replication->lagNanos = nowNanos() - sentAt;
+            }
+            break;
+    }
+
+    // Keep IDs for tasks added after a promotion clear of the leader's.
+    if (id >= list->nextId) {
+        list->nextId = id + 1;
+    }
+    if (version > replication->leaderVersion) {
+        replication->leaderVersion = version;
+    }
+    replication->lastMessageAt = nowNanos();
+}
+
+/**
+ * @brief Reads what the leader sent and applies every complete line.
+ * @param replication The follower's replication state.
+ * @param list The follower's list.
+ */
+void readFromLeader(Replication* replication, TaskList* list) {
+    ssize_t got;
+
+    while ((got = recv(replication->fd, replication->in + replication->inLen,
+                       REPL_BUFFER_SIZE - replication->inLen, 0)) > 0) {
+        char* start = replication->in;
+        char* end;
+
+        replication->inLen += (size_t)got;
+        replication->in[replication->inLen] = '\0';
+        while ((end = strchr(start, '\n')) != NULL) {
+            *end = '\0';
+            applyReplicationLine(replication, list, start);
+            start = end + 1;
+        }
+        // Keep the partial last line for the next read.
+        replication->inLen -= (size_t)(start - replication->in);
+        memmove(replication->in, start, replication->inLen);
+    }
+    if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        printf("Lost the leader at %s; serving the last state and retrying.\n",
+               replication->path);
+        fflush(stdout);
+        close(replication->fd);
+        replication->fd = -1;
+    }
+}
+
+/**
+ * @brief Formats replication state and lag as JSON for GET /replication.
+ * @param replication The replication state.
+ * @param list The local list.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ */
+void describeReplication(Replication* replication, TaskList* list, char* out, size_t room) {
+    int used;
+    int i;
+
+    if (replication->role == ROLE_FOLLOWER) {
+        snprintf(out, room,
+                 "{\"role\":\"follower\",\"connected\":%s,\"applied_version\":%lu,"
+                 "\"leader_version\":%lu,\"lag_versions\":%lu,\"lag_ms\":%.3f,"
+                 "\"since_last_message_ms\":%.3f,\"snapshots_loaded\":%d,\"tasks\":%d}",
+                 replication->fd >= 0 ? "true" : "false", replication->appliedVersion,
+                 replication->leaderVersion,
+                 replication->leaderVersion - replication->appliedVersion,
+                 replication->lagNanos / 1e6,
+                 replication->lastMessageAt ? (nowNanos() - replication->lastMessageAt) / 1e6 : -1.0,
+                 replication->snapshotsLoaded, list->count);
+        return;
+    }
+
+    used = snprintf(out, room, "{\"role\":\"%s\",\"version\":%lu,\"followers\":[",
+                    replication->role == ROLE_LEADER ? "leader" : "standalone", list->version);
+    for (i = 0; i < REPL_MAX_FOLLOWERS && used > 0 && (size_t)used < room; i++) {
+        Follower* follower = &replication->followers[i];
+        if (follower->fd < 0) {
+            continue;
+        }
+        used += snprintf(out + used, room - used,
+                         "%s{\"sent_version\":%lu,\"lag_versions\":%lu,\"queued_changes\":%lu,"
+                         "\"snapshots_sent\":%d}",
+                         out[used - 1] == '[' ? "" : ",", follower->sentVersion,
+                         list->version - follower->sentVersion,
+                         follower->subscriber->tail - follower->subscriber->head,
+                         follower->snapshotsSent);
+    }
+    if (used > 0 && (size_t)used < room) {
+        snprintf(out + used, room - used, "]}");
+    }
+}
+
+// --- Zero-Downtime Restart ---
+//
+// On SIGHUP the server execs a fresh copy of itself (usually a newly
+// installed binary) and hands it everything it needs to carry on, over a
+// Unix socketpair:
+//
+//   1. The old process stops starting new requests, so the list is frozen.
+//   2. It writes the list (and the task file's line index) into a memfd,
+//      and sends that plus the listening socket(s) as SCM_RIGHTS.
+//   3. The new process maps the memfd, rebuilds the list, starts accepting
+//      on the same socket and replies "ready". Nothing is re-read from disk.
+//   4. The old process then passes over each keep-alive connection as soon
+//      as it is between responses, along with any bytes it had buffered for
+//      it, and exits once it has none left.
+//
+// A listing being streamed is finished by the old process first. Change
+// subscribers get a "restart" line and should subscribe again. If the new
+// process dies before saying "ready", the old one just carries on.
+
+/**
+ * @brief Sends one handoff message, optionally with file descriptors attached.
+ * @param sock The handoff socket (SOCK_SEQPACKET, so messages stay whole).
+ * @param message The message header.
+ * @param in Buffered request bytes (message->inLen of them).
+ * @param out Unsent response bytes (message->outLen of them).
+ * @param fds Descriptors to pass along.
+ * @param count How many descriptors.
+ * @return 0 on success, -1 on error.
+ */
+int sendHandoff(int sock, const HandoffMessage* message, const char* in, const char* out,
+                const int* fds, int count) {
+    struct iovec parts[3];
+    struct msghdr header;
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+
+    parts[0].iov_base = (void*)message;
+    parts[0].iov_len = sizeof(*message);
+    parts[1].iov_base = (void*)in;
+    parts[1].iov_len = message->inLen;
+    parts[2].iov_base = (void*)out;
+    parts[2].iov_len = message->outLen;
+
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = parts;
+    header.msg_iovlen = 3;
+    if (count > 0) {
+        struct cmsghdr* rights;
+        memset(control, 0, sizeof(control));
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        rights = CMSG_FIRSTHDR(&header);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type = SCM_RIGHTS;
+        rights->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(rights), fds, sizeof(int) * count);
+    }
+    return sendmsg(sock, &header, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Receives one handoff message.
+ * @param sock The handoff socket.
+ * @param message Receives the message header.
+ * @param payload Receives the in and out bytes, back to back
+ * (room for 2 * HTTP_BUFFER_SIZE).
+ * @param fds Receives attached descriptors (room for HANDOFF_MAX_FDS).
+ * @param count Receives how many descriptors came.
+ * @param flags recvmsg() flags, e.g. MSG_DONTWAIT.
+ * @return 1 if a message arrived, 0 on end of stream, -1 on error
+ * (errno EAGAIN if there was nothing yet).
+ */
+int receiveHandoff(int sock, HandoffMessage* message, char* payload, int* fds, int* count,
+                   int flags) {
+    struct iovec parts[2];
+    struct msghdr header;
+    struct cmsghdr* rights;
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    ssize_t got;
+
+    parts[0].iov_base = message;
+    parts[0].iov_len = sizeof(*message);
+    parts[1].iov_base = payload;
+    parts[1].iov_len = payload ? 2 * HTTP_BUFFER_SIZE : 0;
+
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = parts;
+    header.msg_iovlen = 2;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    *count = 0;
+    got = recvmsg(sock, &header, flags | MSG_CMSG_CLOEXEC);
+    if (got <= 0) {
+        return (int)got;
+    }
+    for (rights = CMSG_FIRSTHDR(&header); rights != NULL; rights = CMSG_NXTHDR(&header, rights)) {
+        if (rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS) {
+            *count = (int)((rights->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(rights), sizeof(int) * *count);
+        }
+    }
+    if ((size_t)got < sizeof(*message) ||
+        (size_t)got != sizeof(*message) + message->inLen + message->outLen) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Writes the list into a memory-only file for the next process.
+ * Layout: a HandoffHeader, then one HandoffTask per live task in order,
+ * then the task file's LineRecords.
+ * @param list A pointer to the list.
+ * @return The memfd, or -1 on error.
+ */
+int writeHandoffState(TaskList* list) {
+    size_t size = sizeof(HandoffHeader) + (size_t)list->count * sizeof(HandoffTask) +
+                  (size_t)list->lineCount * sizeof(LineRecord);
+    int fd = memfd_create("todo-handoff", MFD_CLOEXEC);
+    HandoffHeader* header;
+    HandoffTask* record;
+    Task* current;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) != 0 ||
+        (header = (HandoffHeader*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                       fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    memcpy(header->magic, HANDOFF_MAGIC, sizeof(header->magic));
+    header->version = list->version;
+    header->nextId = list->nextId;
+    header->taskCount = list->count;
+    header->lineCount = list->lineCount;
+    header->fileSize = list->fileSize;
+    header->fileTime = list->fileTime;
+
+    // Nothing writes while a handoff is underway, so the latest version
+    // is stable; no snapshot needed.
+    record = (HandoffTask*)(header + 1);
+    for (current = list->head; current != NULL; current = current->next) {
+        if (isVisible(current, list->version)) {
+            record->id = current->id;
+            record->completed = current->completed;
+            strcpy(record->description, current->description);
+            record++;
+        }
+    }
+    if (list->lineCount > 0) {
+        memcpy(record, list->lines, (size_t)list->lineCount * sizeof(LineRecord));
+    }
+
+    munmap(header, size);
+    return fd;
+}
+
+/**
+ * @brief Rebuilds a list from a memfd written by writeHandoffState().
+ * @param list An empty list.
+ * @param fd The memfd.
+ * @return 0 on success, -1 if the state is unreadable.
+ */
+int readHandoffState(TaskList* list, int fd) {
+    struct stat info;
+    const HandoffHeader* header;
+    const HandoffTask* record;
+    int i;
+
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(HandoffHeader)) {
+        return -1;
+    }
+    header = (const HandoffHeader*)mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE,
+                                        fd, 0);
+    if (header == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(header->magic, HANDOFF_MAGIC, sizeof(header->magic)) != 0 ||
+        (size_t)info.st_size != sizeof(HandoffHeader) +
+                                    (size_t)header->taskCount * sizeof(HandoffTask) +
+                                    (size_t)header->lineCount * sizeof(LineRecord)) {
+        munmap((void*)header, (size_t)info.st_size);
+        return -1;
+    }
+
+    record = (const HandoffTask*)(header + 1);
+    for (i = 0; i < header->taskCount; i++, record++) {
+        addTask(list, record->description);
+        list->tail->id = record->id;
+        list->tail->completed = record->completed;
+        list->done += record->completed != 0;
+    }
+    list->nextId = header->nextId;
+    list->version = header->version;
+
+    // Carry the line index over, so external edits are still matched
+    // against what the file held before the restart.
+    if (header->lineCount > 0) {
+        list->lines = (LineRecord*)memoryAllocate((size_t)header->lineCount * sizeof(LineRecord));
+        if (list->lines == NULL) {
+            printf("Error: Could not allocate memory for line index.\n");
+            exit(1);
+        }
+        memcpy(list->lines, record, (size_t)header->lineCount * sizeof(LineRecord));
+    }
+    list->lineCount = header->lineCount;
+    list->lineCapacity = header->lineCount;
+    list->fileSize = header->fileSize;
+    list->fileTime = header->fileTime;
+
+    munmap((void*)header, (size_t)info.st_size);
+    return 0;
+}
+
+/**
+ * @brief Starts a handoff: freezes the list, execs the new process and
+ * sends it the list and the listening sockets.
+ * @param server The server.
+ * @param options The command line, re-used for the new process.
+ * @return 0 if the handoff started, -1 if it couldn't (and nothing changed).
+ */
+int startHandoff(Server* server, const Options* options) {
+    HandoffMessage message;
+    int pair[2];
+    int fds[HANDOFF_MAX_FDS];
+    int count = 0;
+    int state;
+    pid_t pid;
+    char** argv;
+    char fdText[16];
+    int argc = 0;
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0) {
+        printf("Error: Could not start restart (%s).\n", strerror(errno));
+        return -1;
+    }
+    // Other lists go through their files; the new process loads them on demand.
+    workspaceSaveAll(&server->workspace);
+    state = writeHandoffState(server->list);
+    if (state < 0) {
+        printf("Error: Could not start restart (%s).\n", strerror(errno));
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    // The new process's command line: ours, plus where to find us. Built
+    // here, as other threads (the executor, --threads shards) may hold the
+    // malloc or stdio locks when we fork, and the child would wait on them
+    // forever; it only makes async-signal-safe calls.
+    argv = (char**)malloc(sizeof(char*) * (size_t)(options->argc + 3));
+    if (argv == NULL) {
+        printf("Error: Could not allocate memory for restart.\n");
+        exit(1);
+    }
+    for (i = 0; i < options->argc; i++) {
+        if (strcmp(options->argv[i], "--takeover") == 0 && i + 1 < options->argc) {
+            i++; // We were handed off to once already.
+            continue;
+        }
+        argv[argc++] = options->argv[i];
+    }
+    snprintf(fdText, sizeof(fdText), "%d", pair[1]);
+    argv[argc++] = "--takeover";
+    argv[argc++] = fdText;
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        static const char failed[] = "Error: Could not run the new process.\n";
+
+        fcntl(pair[1], F_SETFD, 0); // Keep this one across exec.
+        execvp(argv[0], argv);
+        if (write(STDOUT_FILENO, failed, sizeof(failed) - 1) < 0) {
+            // Nothing more we can do from here.
+        }
+        _exit(127);
+    }
+    free(argv);
+    close(pair[1]);
+    if (pid < 0) {
+        printf("Error: Could not start restart (%s).\n", strerror(errno));
+        close(pair[0]);
+        close(state);
+        return -1;
+    }
+
+    fds[count++] = state;
+    fds[count++] = server->listener;
+    if (server->replication.role == ROLE_LEADER) {
+        fds[count++] = server->replication.fd;
+    }
+    memset(&message, 0, sizeof(message));
+    message.kind = HANDOFF_STATE;
+    if (sendHandoff(pair[0], &message, NULL, NULL, fds, count) != 0) {
+        // The new process will see end-of-stream and exit.
+        printf("Error: Could not start restart (%s).\n", strerror(errno));
+        close(pair[0]);
+        close(state);
+        return -1;
+    }
+    close(state);
+
+    server->handoffFd = pair[0];
+    server->handoffPhase = HANDOFF_STARTING;
+    server->successor = pid;
+    printf("Restarting: handing off to process %d.\n", (int)pid);
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * @brief Takes over from the process that exec'd us: rebuilds the list
+ * and adopts its listening sockets.
+ * @param server The server; on success 'listener' is set and 'handoffFd'
+ * is kept open for the connections still to come.
+ * @param sock The handoff socket (from --takeover).
+ * @param replicationFd Receives the old replication listener (-1 if none).
+ * @return 0 on success, -1 on error.
+ */
+int takeOverServer(Server* server, int sock, int* replicationFd) {
+    HandoffMessage message;
+    int fds[HANDOFF_MAX_FDS];
+    int count = 0;
+    int i;
+
+    *replicationFd = -1;
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    if (receiveHandoff(sock, &message, NULL, fds, &count, 0) != 1 ||
+        message.kind != HANDOFF_STATE || count < 2 ||
+        readHandoffState(server->list, fds[0]) != 0) {
+        printf("Error: Could not take over from the previous process.\n");
+        for (i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        close(sock);
+        return -1;
+    }
+    close(fds[0]);
+    server->listener = fds[1];
+    if (count > 2) {
+        *replicationFd = fds[2];
+    }
+
+    // Tell the old process we're serving, so it can let go.
+    memset(&message, 0, sizeof(message));
+    message.kind = HANDOFF_READY;
+    sendHandoff(sock, &message, NULL, NULL, NULL, 0);
+
+    server->handoffFd = sock;
+    printf("Took over from process %d with %d task(s).\n", (int)getppid(), server->list->count);
+    return 0;
+}
+
+/**
+ * @brief Handles input on the handoff socket: the new process's "ready"
+ * (old side), or the connections being handed over (new side).
+ * @param server The server.
+ */
+void serviceHandoff(Server* server) {
+    static char payload[2 * HTTP_BUFFER_SIZE];
+    HandoffMessage message;
+    int fds[HANDOFF_MAX_FDS];
+    int count;
+    int got;
+    int i;
+
+    while ((got = receiveHandoff(server->handoffFd, &message, payload, fds, &count,
+                                 MSG_DONTWAIT)) == 1) {
+        if (message.kind == HANDOFF_READY && server->handoffPhase == HANDOFF_STARTING) {
+            // The new process is accepting now; stop listening ourselves.
+            close(server->listener);
+            server->listener = -1;
+            if (server->replication.role == ROLE_LEADER) {
+                // Followers reconnect to the new process and re-sync.
+                for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+                    if (server->replication.followers[i].fd >= 0) {
+                        dropFollower(&server->replication.followers[i]);
+                    }
+                }
+            }
+            if (server->replication.fd >= 0) {
+                close(server->replication.fd);
+                server->replication.fd = -1;
+            }
+            server->handoffPhase = HANDOFF_DRAINING;
+        } else if (message.kind == HANDOFF_CLIENT && count == 1) {
+            for (i = 0; i < HTTP_MAX_CLIENTS && server->clients[i].fd >= 0; i++) {
+            }
+            if (i == HTTP_MAX_CLIENTS) {
+                close(fds[0]); // Too many connections.
+                continue;
+            }
+            HttpClient* client = &server->clients[i];
+            client->fd = fds[0];
+            client->keepAlive = message.keepAlive;
+            memcpy(client->in, payload, message.inLen);
+            client->inLen = message.inLen;
+            memcpy(client->out, payload + message.inLen, message.outLen);
+            client->outLen = message.outLen;
+            server->connections++;
+            httpAdmitRequests(server, client); // Requests that came with it queue here now.
+        } else {
+            for (i = 0; i < count; i++) {
+                close(fds[i]);
+            }
+        }
+    }
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        if (server->handoffPhase == HANDOFF_STARTING) {
+            // The new process died before taking over. Carry on as before.
+            printf("Error: Restart failed; still serving from this process.\n");
+            fflush(stdout);
+            waitpid(server->successor, NULL, 0);
+            server->handoffPhase = HANDOFF_NONE;
+        }
+        close(server->handoffFd);
+        server->handoffFd = -1;
+    }
+}
+
+/**
+ * @brief While draining, passes each connection that is between responses
+ * to the new process, and ends change streams.
+ * @param server The server, in HANDOFF_DRAINING.
+ * @return The number of connections still left here.
+ */
+int handOffClients(Server* server) {
+    HandoffMessage message;
+    int left = 0;
+    int i;
+
+    for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        HttpClient* client = &server->clients[i];
+        if (client->fd < 0) {
+            continue;
+        }
+        if (client->streaming || client->job != NULL) {
+            left++; // Finish the listing (or job) here first.
+            continue;
+        }
+        if (client->subscriber != NULL) {
+            // Changes now happen in the new process; tell the subscriber
+            // to go and subscribe there.
+            size_t room = httpBeginChunk(client);
+            char* data = client->out + client->outLen + HTTP_CHUNK_HEADER;
+            if (room >= 32) {
+                size_t used = (size_t)sprintf(data, "{\"type\":\"restart\"}\n");
+                httpEndChunk(client, used, 1);
+                unsubscribe(client->subscriber);
+                client->subscriber = NULL;
+            }
+            left++;
+            continue;
+        }
+        if (!client->keepAlive) {
+            left++; // Closes once its response is sent.
+            continue;
+        }
+
+        memset(&message, 0, sizeof(message));
+        message.kind = HANDOFF_CLIENT;
+        message.keepAlive = client->keepAlive;
+        message.inLen = client->inLen;
+        message.outLen = client->outLen - client->outSent;
+        if (server->handoffFd >= 0) {
+            sendHandoff(server->handoffFd, &message, client->in,
+                        client->out + client->outSent, &client->fd, 1);
+        }
+        httpCloseClient(server, client); // Closes our copy; the new process has its own.
+    }
+    return left;
+}
+
+// --- Async Jobs ---
+//
+// Work that has to wait (for the disk, say) without holding up the
+// server is written as a job: a function that reads straight through,
+// with ASYNC_AWAIT()/ASYNC_CALL() where it waits, but that actually
+// returns to the event loop at each of those points and is called
+// again later to carry on where it left off. See ASYNC_BEGIN() for the
+// rules. The executor runs blocking calls on a worker thread and wakes
+// the event loop through an eventfd when they finish.
+
+/**
+ * @brief Body of the executor's worker thread: runs submitted calls one
+ * at a time and hands the jobs back to the event loop.
+ * @param arg The executor.
+ */
+void* executorWorker(void* arg) {
+    Executor* executor = (Executor*)arg;
+    unsigned long long one = 1;
+
+    pthread_mutex_lock(&executor->lock);
+    while (1) {
+        while (executor->submitted == NULL && !executor->stopping) {
+            pthread_cond_wait(&executor->wake, &executor->lock);
+        }
+        if (executor->submitted == NULL) {
+            break; // Stopping, and nothing left to run.
+        }
+        Job* job = executor->submitted;
+        executor->submitted = job->nextCall;
+        pthread_mutex_unlock(&executor->lock);
+
+        // The job itself is parked until we hand it back, so only this
+        // thread touches it meanwhile.
+        errno = 0;
+        job->callResult = job->call(job->callArg);
+        job->callErrno = errno;
+
+        pthread_mutex_lock(&executor->lock);
+        job->nextCall = executor->finished;
+        executor->finished = job;
+        if (write(executor->eventFd, &one, sizeof(one)) < 0) {
+            // The counter can't overflow in practice; the loop still wakes.
+        }
+    }
+    pthread_mutex_unlock(&executor->lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts an executor and its worker thread.
+ * @param executor The executor.
+ * @return 0 on success, -1 on error.
+ */
+int executorStart(Executor* executor) {
+    memset(executor, 0, sizeof(*executor));
+    executor->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (executor->eventFd < 0) {
+        return -1;
+    }
+    pthread_mutex_init(&executor->lock, NULL);
+    pthread_cond_init(&executor->wake, NULL);
+    if (pthread_create(&executor->worker, NULL, executorWorker, executor) != 0) {
+        close(executor->eventFd);
+        executor->eventFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs jobs until none are left, then stops the worker thread.
+ * @param executor The executor.
+ */
+void executorStop(Executor* executor) {
+    if (executor->eventFd < 0) {
+        return;
+    }
+    while (executor->jobs != NULL) {
+        struct pollfd wait = { executor->eventFd, POLLIN, 0 };
+        executorRun(executor);
+        if (executor->jobs != NULL && executorReady(executor) == 0) {
+            poll(&wait, 1, -1);
+        }
+    }
+    pthread_mutex_lock(&executor->lock);
+    executor->stopping = 1;
+    pthread_cond_signal(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+    pthread_join(executor->worker, NULL);
+    pthread_mutex_destroy(&executor->lock);
+    pthread_cond_destroy(&executor->wake);
+    close(executor->eventFd);
+    executor->eventFd = -1;
+}
+
+/**
+ * @brief Starts a job: runs it up to its first wait.
+ * @param executor The executor.
+ * @param job The job, with 'step' (and its own state) filled in. It is
+ * freed with free() once 'step' returns ASYNC_DONE.
+ */
+void executorSpawn(Executor* executor, Job* job) {
+    job->executor = executor;
+    job->resumeAt = 0;
+    job->waiting = 0;
+    job->next = executor->jobs;
+    executor->jobs = job;
+    executor->spawned++;
+    executorRun(executor);
+}
+
+/**
+ * @brief Parks a job and has the worker thread run a blocking call for it.
+ * Use through ASYNC_CALL().
+ * @param job The job.
+ * @param call The function to run; its return value lands in job->callResult
+ * and errno in job->callErrno.
+ * @param arg The function's argument.
+ */
+void executorSubmit(Job* job, int (*call)(void*), void* arg) {
+    Executor* executor = job->executor;
+
+    job->call = call;
+    job->callArg = arg;
+    job->waiting = 1;
+    job->nextCall = NULL;
+
+    pthread_mutex_lock(&executor->lock);
+    Job** tail = &executor->submitted;
+    while (*tail != NULL) {
+        tail = &(*tail)->nextCall;
+    }
+    *tail = job; // First come, first served.
+    pthread_cond_signal(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * @brief Counts the jobs that can run right now (not parked on a call).
+ * The event loop shouldn't sleep while there are any.
+ * @param executor The executor.
+ */
+int executorReady(Executor* executor) {
+    int ready = 0;
+    Job* job;
+
+    for (job = executor->jobs; job != NULL; job = job->next) {
+        ready += !job->waiting;
+    }
+    return ready;
+}
+
+/**
+ * @brief Takes back finished calls and runs every job that can run, once.
+ * Call it from the event loop when the eventfd is readable, and whenever
+ * executorReady() says there's something to do.
+ * @param executor The executor.
+ */
+void executorRun(Executor* executor) {
+    unsigned long long count;
+    Job** link;
+    Job* finished;
+
+    if (read(executor->eventFd, &count, sizeof(count)) < 0) {
+        // EAGAIN: nothing finished since last time.
+    }
+    pthread_mutex_lock(&executor->lock);
+    finished = executor->finished;
+    executor->finished = NULL;
+    pthread_mutex_unlock(&executor->lock);
+    for (; finished != NULL; finished = finished->nextCall) {
+        finished->waiting = 0;
+    }
+
+    link = &executor->jobs;
+    while (*link != NULL) {
+        Job* job = *link;
+        if (job->waiting || job->step(job) == ASYNC_PENDING) {
+            link = &job->next;
+            continue;
+        }
+        *link = job->next; // Done.
+        executor->completed++;
+        free(job);
+    }
+}
+
+/**
+ * @brief Worker-thread half of saveTasksAsync(): writes the formatted
+ * file to a temporary name.
+ * @param arg The SaveJob.
+ * @return 0 on success, -1 on error (errno set).
+ */
+int saveJobWrite(void* arg) {
+    SaveJob* job = (SaveJob*)arg;
+    size_t written = 0;
+
+    job->fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (job->fd < 0) {
+        return -1;
+    }
+    while (written < job->length) {
+        ssize_t wrote = write(job->fd, job->data + written, job->length - written);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        written += (size_t)wrote;
+    }
+    metricAdd(METRIC_BYTES_WRITTEN, written);
+    metricAdd(METRIC_OP_SAVE, 1);
+    return 0;
+}
+
+/**
+ * @brief Worker-thread half of saveTasksAsync(): waits for the written
+ * file to reach the disk.
+ * @param arg The SaveJob.
+ * @return 0 on success, -1 on error (errno set).
+ */
+int saveJobSync(void* arg) {
+    SaveJob* job = (SaveJob*)arg;
+    return fsync(job->fd);
+}
+
+/**
+ * @brief Finishes a save job: replies to the client (if it's still
+ * connected) and cleans up.
+ * @param job The job.
+ * @param status HTTP status line text.
+ * @param body The JSON body.
+ */
+void finishSaveJob(SaveJob* job, const char* status, const char* body) {
+    if (job->fd >= 0) {
+        close(job->fd);
+        job->fd = -1;
+    }
+    if (job->data != NULL) {
+        free(job->data);
+        job->data = NULL;
+    }
+    if (job->lines != NULL) {
+        memoryRelease(job->lines, (size_t)job->lineCapacity * sizeof(LineRecord));
+        job->lines = NULL;
+    }
+    if (job->base.executor->saving == &job->base) {
+        job->base.executor->saving = NULL;
+    }
+    job->list->pins--;
+    if (job->base.client != NULL) {
+        httpRespond(job->base.client, status, body);
+        job->base.client->job = NULL;
+        job->base.client = NULL;
+    }
+}
+
+/**
+ * @brief The steps of an async save, as one coroutine:
+ * wait for any earlier save; format the list from a snapshot, a batch
+ * at a time; await the write; await fsync; rename over tasks.txt; reply.
+ * @param base The SaveJob.
+ * @return ASYNC_PENDING or ASYNC_DONE.
+ */
+int saveJobStep(Job* base) {
+    SaveJob* job = (SaveJob*)base;
+    Executor* executor = base->executor;
+    char error[128];
+    int batch;
+
+    ASYNC_BEGIN(base);
+
+    // One save at a time; they all write the same file.
+    ASYNC_AWAIT(base, executor->saving == NULL);
+    executor->saving = base;
+
+    // 1. Format the file from a snapshot, yielding to the event loop
+    //    between batches so a big list doesn't stall other clients.
+    job->snapshot = openSnapshot(job->list);
+    job->cursor = job->list->head;
+    while (job->cursor != NULL) {
+        for (batch = 0; job->cursor != NULL && batch < SAVE_BATCH; job->cursor = job->cursor->next) {
+            if (isVisible(job->cursor, job->snapshot.version)) {
+                appendTaskLine(job, job->cursor);
+                batch++;
+            }
+        }
+        // Pause only on a record our snapshot keeps alive.
+        job->cursor = firstVisible(job->cursor, job->snapshot.version);
+        if (job->cursor != NULL) {
+            ASYNC_YIELD(base);
+        }
+    }
+    closeSnapshot(&job->snapshot);
+
+    // 2. Write it and wait for it to reach the disk, off this thread.
+    ASYNC_CALL(base, saveJobWrite, job);
+    if (base->callResult != 0) {
+        goto failed;
+    }
+    ASYNC_CALL(base, saveJobSync, job);
+    if (base->callResult != 0) {
+        goto failed;
+    }
+
+    // 3. Swap it in. A crash before this leaves the old file intact.
+    if (rename(job->path, job->list->file) != 0) {
+        base->callErrno = errno;
+        goto failed;
+    }
+    memoryRelease(job->list->lines, (size_t)job->list->lineCapacity * sizeof(LineRecord));
+    job->list->lines = job->lines;
+    job->list->lineCount = job->lineCount;
+    job->list->lineCapacity = job->lineCapacity;
+    job->lines = NULL;
+    recordFileState(job->list, (off_t)job->length);
+    job->list->savedVersion = job->snapshot.version;
+
+    finishSaveJob(job, "200 OK", "{\"ok\":true}");
+    ASYNC_RETURN(base);
+
+failed:
+    unlink(job->path);
+    snprintf(error, sizeof(error), "{\"error\":\"save failed: %s\"}", strerror(base->callErrno));
+    finishSaveJob(job, "500 Internal Server Error", error);
+    ASYNC_END(base);
+}
+
+/**
+ * @brief Formats one task's file line onto a save job's buffer, and
+ * records it for the line index.
+ * @param job The job.
+ * @param task The task.
+ */
+void appendTaskLine(SaveJob* job, const Task* task) {
+    if (job->capacity - job->length < MAX_TASK_LEN + 16) {
+        size_t capacity = job->capacity ? job->capacity * 2 : 65536;
+        char* grown = (char*)realloc(job->data, capacity);
+        if (grown == NULL) {
+            printf("Error: Could not allocate memory for save.\n");
+            exit(1);
+        }
+        job->data = grown;
+        job->capacity = capacity;
+    }
+    if (job->lineCount == job->lineCapacity) {
+        int capacity = job->lineCapacity ? job->lineCapacity * 2 : 64;
+        LineRecord* grown = (LineRecord*)memoryResize(job->lines,
+                                                      job->lineCapacity * sizeof(LineRecord),
+                                                      capacity * sizeof(LineRecord));
+        if (grown == NULL) {
+            printf("Error: Could not allocate memory for line index.\n");
+            exit(1);
+        }
+        job->lines = grown;
+        job->lineCapacity = capacity;
+    }
+
+    char* line = job->data + job->length;
+    int length = sprintf(line, "%d,%s", task->completed, task->description);
+    LineRecord* record = &job->lines[job->lineCount++];
+    record->offset = (off_t)job->length;
+    record->length = (size_t)length;
+    record->hash = hashLine(line, (size_t)length);
+    record->id = task->id;
+    line[length] = '\n';
+    job->length += (size_t)length + 1;
+}
+
+/**
+ * @brief Starts saving the list without blocking the event loop.
+ * The client gets its reply once the file is on disk.
+ * @param executor The executor to run on.
+ * @param list The list to save.
+ * @param client The connection to reply to.
+ */
+void saveTasksAsync(Executor* executor, TaskList* list, HttpClient* client) {
+    SaveJob* job = (SaveJob*)calloc(1, sizeof(SaveJob));
+    if (job == NULL) {
+        printf("Error: Could not allocate memory for save.\n");
+        exit(1);
+    }
+    job->base.step = saveJobStep;
+    job->base.client = client;
+    job->list = list;
+    job->fd = -1;
+    snprintf(job->path, sizeof(job->path), "%s.tmp", list->file);
+    list->pins++; // Keep the list in memory until the job is done.
+    client->job = &job->base;
+    executorSpawn(executor, &job->base);
+}
+
+// --- Workspaces ---
+//
+// A workspace is a directory of lists, one file per list: "groceries"
+// lives in groceries.txt. The server's own list is "tasks" (tasks.txt).
+// A list is only read from disk the first time a request names it, and
+// lists nobody has used for a while are saved and dropped from memory
+// whenever the loaded lists together go over the memory budget. So the
+// workspace as a whole can be far bigger than memory, and each request
+// only touches its own list.
+
+/**
+ * @brief Checks that a list name is safe to use as a file name.
+ * @param name The name.
+ * @return 1 if it's 1 to LIST_NAME_MAX - 1 letters, digits, '-' or '_'.
+ */
+int validListName(const char* name) {
+    size_t length = strlen(name);
+    size_t i;
+
+    if (length == 0 || length >= LIST_NAME_MAX) {
+        return 0;
+    }
+    for (i = 0; i < length; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Estimates the memory a loaded list is using.
+ * @param list The list.
+ * @return Bytes.
+ */
+size_t listMemory(const TaskList* list) {
+    return sizeof(TaskList) +
+           (size_t)(list->count + list->garbage) * taskRecordSize() +
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+           (size_t)list->positionCapacity * sizeof(Task*) +
+#endif
+           (size_t)list->lineCapacity * sizeof(LineRecord) +
+           (size_t)list->snapshotCapacity * sizeof(unsigned long);
+}
+
+/**
+ * @brief Checks whether anything still points into a list, so it can't
+ * be evicted: an open snapshot (a streamed listing), a subscriber, or an
+ * async job.
+ * @param list The list.
+ * @return 1 if in use.
+ */
+int listInUse(const TaskList* list) {
+    return list->snapshotCount > 0 || list->subscribers != NULL || list->pins > 0;
+}
+
+/**
+ * @brief Sets up a workspace around the server's own list.
+ * @param workspace The workspace.
+ * @param mainList The server's list, registered as "tasks" and never evicted
+ * (NULL for a shard that doesn't own it).
+ * @param budget Memory budget for loaded lists, in bytes.
+ */
+void workspaceInit(Workspace* workspace, TaskList* mainList, size_t budget) {
+    memset(workspace, 0, sizeof(*workspace));
+    workspace->budget = budget;
+    if (mainList == NULL) {
+        return;
+    }
+
+    ListEntry* entry = workspaceFind(workspace, "tasks", 1);
+    entry->list = mainList;
+    entry->pinned = 1;
+    workspace->mainEntry = entry;
+    workspaceTouch(workspace, entry);
+}
+
+/**
+ * @brief Looks up a list by name.
+ * @param workspace The workspace.
+ * @param name The list's name (already validated).
+ * @param create Add an (unloaded) entry if there isn't one.
+ * @return The entry, or NULL if not found and not created.
+ */
+ListEntry* workspaceFind(Workspace* workspace, const char* name, int create) {
+    ListEntry* entry;
+
+    for (entry = workspace->entries; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    entry = (ListEntry*)calloc(1, sizeof(ListEntry));
+    if (entry == NULL) {
+        printf("Error: Could not allocate memory for list entry.\n");
+        exit(1);
+    }
+    strcpy(entry->name, name);
+    entry->next = workspace->entries;
+    workspace->entries = entry;
+    return entry;
+}
+
+/**
+ * @brief Returns a list, loading it from its file if it isn't in memory.
+ * @param workspace The workspace.
+ * @param name The list's name (already validated).
+ * @return The list. A list with no file yet starts empty.
+ */
+TaskList* workspaceOpen(Workspace* workspace, const char* name) {
+    ListEntry* entry = workspaceFind(workspace, name, 1);
+    char file[LIST_NAME_MAX + 8];
+
+    metricAdd(entry->list != NULL ? METRIC_LIST_HITS : METRIC_LIST_MISSES, 1);
+    if (entry->list == NULL) {
+        entry->list = (TaskList*)malloc(sizeof(TaskList));
+        if (entry->list == NULL) {
+            printf("Error: Could not allocate memory for list.\n");
+            exit(1);
+        }
+        initList(entry->list);
+        snprintf(file, sizeof(file), "%s.txt", name);
+        setListFile(entry->list, file);
+        loadTasks(entry->list);
+        workspace->loads++;
+        workspace->loadedCount++;
+    }
+    entry->lastUsed = nowNanos();
+    workspaceTouch(workspace, entry);
+    return entry->list;
+}
+
+/**
+ * @brief Re-measures a loaded list after it was used.
+ * @param workspace The workspace.
+ * @param entry The list's entry.
+ */
+void workspaceTouch(Workspace* workspace, ListEntry* entry) {
+    size_t bytes = entry->list ? listMemory(entry->list) : 0;
+
+    workspace->loadedBytes += bytes - entry->bytes;
+    entry->bytes = bytes;
+}
+
+/**
+ * @brief Saves a list if it has unsaved changes and drops it from memory.
+ * @param workspace The workspace.
+ * @param entry The list's entry (loaded, not pinned, not in use).
+ */
+void workspaceEvict(Workspace* workspace, ListEntry* entry) {
+    TRACE_SPAN("evict list");
+    if (entry->list->version != entry->list->savedVersion) {
+        saveTasks(entry->list);
+    }
+    freeList(entry->list);
+    free(entry->list);
+    entry->list = NULL;
+    workspaceTouch(workspace, entry);
+    workspace->loadedCount--;
+    workspace->evictions++;
+}
+
+/**
+ * @brief Evicts least-recently-used lists until the loaded lists fit in
+ * the budget (or nothing else can be evicted).
+ * @param workspace The workspace.
+ */
+void workspaceEnforceBudget(Workspace* workspace) {
+    while (workspace->loadedBytes > workspace->budget) {
+        ListEntry* oldest = NULL;
+        ListEntry* entry;
+
+        for (entry = workspace->entries; entry != NULL; entry = entry->next) {
+            if (entry->list != NULL && !entry->pinned && !listInUse(entry->list) &&
+                (oldest == NULL || entry->lastUsed < oldest->lastUsed)) {
+                oldest = entry;
+            }
+        }
+        if (oldest == NULL) {
+            return; // Everything left is in use; try again later.
+        }
+        workspaceEvict(workspace, oldest);
+    }
+}
+
+/**
+ * @brief Saves every loaded list with unsaved changes (the server's own
+ * list excepted; it is saved separately).
+ * @param workspace The workspace.
+ */
+void workspaceSaveAll(Workspace* workspace) {
+    ListEntry* entry;
+
+    for (entry = workspace->entries; entry != NULL; entry = entry->next) {
+        if (entry->list != NULL && !entry->pinned &&
+            entry->list->version != entry->list->savedVersion) {
+            saveTasks(entry->list);
+        }
+    }
+}
+
+/**
+ * @brief Saves and frees every list, and the entries themselves.
+ * @param workspace The workspace.
+ */
+void workspaceClose(Workspace* workspace) {
+    workspaceSaveAll(workspace);
+    while (workspace->entries != NULL) {
+        ListEntry* entry = workspace->entries;
+        workspace->entries = entry->next;
+        if (entry->list != NULL && !entry->pinned) {
+            freeList(entry->list);
+            free(entry->list);
+        }
+        free(entry);
+    }
+    workspace->loadedBytes = 0;
+    workspace->loadedCount = 0;
+}
+
+/**
+ * @brief Drains pending inotify events and re-syncs each loaded list
+ * whose file changed. The workspace version of reloadChangedTasks().
+ * @param workspace The workspace.
+ * @param watchFd The descriptor from watchTasksFile() (-1 = not watching).
+ */
+void workspaceReloadChanged(Workspace* workspace, int watchFd) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ListEntry* entry;
+    ssize_t length;
+
+    if (watchFd < 0) {
+        return;
+    }
+    while ((length = read(watchFd, events, sizeof(events))) > 0) {
+        char* position = events;
+        while (position < events + length) {
+            struct inotify_event* event = (struct inotify_event*)position;
+            for (entry = workspace->entries; event->len > 0 && entry != NULL; entry = entry->next) {
+                if (entry->list != NULL && strcmp(event->name, entry->list->file) == 0) {
+                    entry->changed = 1;
+                }
+            }
+            position += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    // Lists that aren't loaded need nothing; they'll be read fresh.
+    for (entry = workspace->entries; entry != NULL; entry = entry->next) {
+        if (entry->changed && entry->list != NULL) {
+            int changed = syncTasksFile(entry->list);
+            if (changed > 0) {
+                printf("\n%s changed on disk; reloaded %d task(s).\n", entry->list->file, changed);
+            }
+            workspaceTouch(workspace, entry);
+        }
+        entry->changed = 0;
+    }
+}
+
+/**
+ * @brief Describes the workspace (for GET /workspace) as JSON.
+ * @param workspace The workspace.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ */
+void describeWorkspace(Workspace* workspace, char* out, size_t room) {
+    snprintf(out, room,
+             "{\"loaded_lists\":%d,\"loaded_bytes\":%zu,\"budget_bytes\":%zu,"
+             "\"loads\":%lu,\"evictions\":%lu}",
+             workspace->loadedCount + (workspace->mainEntry != NULL),
+             workspace->loadedBytes, workspace->budget,
+             workspace->loads, workspace->evictions);
+}
+
+/**
+ * @brief Replies to GET /lists with every list in the workspace directory.
+ * @param client The connection.
+ * @param workspace The workspace.
+ */
+void httpListLists(HttpClient* client, Workspace* workspace) {
+    char body[HTTP_BUFFER_SIZE / 2];
+    size_t used = 0;
+    DIR* directory = opendir(".");
+    struct dirent* file;
+
+    body[used++] = '[';
+    while (directory != NULL && (file = readdir(directory)) != NULL) {
+        char name[LIST_NAME_MAX];
+        size_t length = strlen(file->d_name);
+        ListEntry* entry;
+
+        if (length < 5 || length - 4 >= LIST_NAME_MAX ||
+            strcmp(file->d_name + length - 4, ".txt") != 0) {
+            continue;
+        }
+        memcpy(name, file->d_name, length - 4);
+        name[length - 4] = '\0';
+        if (!validListName(name)) {
+            continue;
+        }
+        if (used + LIST_NAME_MAX + 64 > sizeof(body)) {
+            break; // Only as many as fit in one response.
+        }
+        entry = workspaceFind(workspace, name, 0);
+        used += (size_t)snprintf(body + used, sizeof(body) - used, "%s{\"name\":\"%s\",\"loaded\":%s",
+                                 used > 1 ? "," : "", name,
+                                 entry && entry->list ? "true" : "false");
+        if (entry && entry->list) {
+            used += (size_t)snprintf(body + used, sizeof(body) - used, ",\"tasks\":%d",
+                                     entry->list->count);
+        }
+        body[used++] = '}';
+    }
+    if (directory != NULL) {
+        closedir(directory);
+    }
+    body[used++] = ']';
+    body[used] = '\0';
+    httpRespond(client, "200 OK", body);
+}
+
+// --- Sharded Server ---
+//
+// With --threads N the server runs as N shards, each a thread pinned to
+// its own core with its own poll() loop, listening socket (SO_REUSEPORT,
+// so the kernel spreads connections over them), workspace, and share of
+// the memory budget. A list belongs to exactly one shard, picked by
+// hashing its name, and only that shard's thread ever touches it, so
+// lists need no locks. A request that lands on the wrong shard is passed
+// to the owner over a lock-free single-producer, single-consumer queue,
+// and the response comes back the same way in pieces; the connection
+// waits meanwhile, just as it does for an async save.
+//
+// Each shard allocates its own loop, queues and lists after it has been
+// pinned, so on a NUMA machine the kernel's first-touch policy puts them
+// on that core's memory node, and glibc gives each thread its own malloc
+// arena. Subscriptions and replication aren't available in this mode.
+
+/**
+ * @brief Serves with one pinned thread per shard until SIGINT/SIGTERM,
+ * then saves every list.
+ * @param list The main list ("tasks"), already loaded; its owner shard
+ * serves it.
+ * @param options The port, --threads and the memory budget.
+ * @return 0 on clean shutdown, 1 if a shard couldn't start.
+ */
+int runShardedServer(TaskList* list, const Options* options) {
+    ShardGroup group;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long forwarded = 0;
+    unsigned long handled = 0;
+    int count = options->threads;
+    int i;
+
+    if (cpus < 1) {
+        cpus = 1;
+    }
+    memset(&group, 0, sizeof(group));
+    group.count = count;
+    group.mainList = list;
+    group.options = options;
+    group.shards = (Shard*)aligned_alloc(64, (size_t)count * sizeof(Shard));
+    group.requests = (ShardQueue**)calloc((size_t)count * count, sizeof(ShardQueue*));
+    group.responses = (ShardQueue**)calloc((size_t)count * count, sizeof(ShardQueue*));
+    if (group.shards == NULL || group.requests == NULL || group.responses == NULL) {
+        printf("Error: Could not allocate memory for shards.\n");
+        exit(1);
+    }
+    memset(group.shards, 0, (size_t)count * sizeof(Shard));
+    pthread_barrier_init(&group.started, NULL, (unsigned)count);
+    pthread_barrier_init(&group.stopped, NULL, (unsigned)count);
+
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < count; i++) {
+        Shard* shard = &group.shards[i];
+        shard->index = i;
+        shard->cpu = (int)(i % cpus);
+        shard->eventFd = -1;
+        shard->group = &group;
+        if (pthread_create(&shard->thread, NULL, runShard, shard) != 0) {
+            printf("Error: Could not start shard %d.\n", i);
+            exit(1);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(group.shards[i].thread, NULL);
+        forwarded += group.shards[i].forwardedRequests;
+    }
+    for (i = 0; i < count; i++) {
+        handled += group.shards[i].servedRequests;
+    }
+    printf("\nServer stopped (%d shards; %lu of their requests forwarded, %lu served).\n",
+           count, forwarded, handled);
+
+    pthread_barrier_destroy(&group.started);
+    pthread_barrier_destroy(&group.stopped);
+    free(group.requests);
+    free(group.responses);
+    free(group.shards);
+    return group.failed ? 1 : 0;
+}
+
+/**
+ * @brief One shard's thread: pins itself, sets up its loop and queues,
+ * and serves until asked to stop; then saves its lists.
+ * @param arg The Shard.
+ * @return NULL.
+ */
+void* runShard(void* arg) {
+    Shard* shard = (Shard*)arg;
+    ShardGroup* group = shard->group;
+    const Options* options = group->options;
+    int shards = group->count;
+    struct pollfd fds[HTTP_MAX_CLIENTS + 3];
+    int slots[HTTP_MAX_CLIENTS + 3];
+    cpu_set_t cpus;
+    Server* server;
+    int i;
+
+    // Pin first, so everything allocated below is first touched from
+    // this core.
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        printf("Warning: Could not pin shard %d to CPU %d.\n", shard->index, shard->cpu);
+    }
+
+    server = (Server*)calloc(1, sizeof(Server));
+    shard->peers = (ShardPeer*)calloc((size_t)shards, sizeof(ShardPeer));
+    if (server == NULL || shard->peers == NULL) {
+        printf("Error: Could not allocate memory for shard %d.\n", shard->index);
+        exit(1);
+    }
+    // Queues live with their consumer: requests to us, and responses to
+    // requests we sent.
+    for (i = 0; i < shards; i++) {
+        group->requests[i * shards + shard->index] =
+            shardQueueCreate(sizeof(ShardRequest), SHARD_REQUEST_SLOTS);
+        group->responses[i * shards + shard->index] =
+            shardQueueCreate(sizeof(ShardResponse), SHARD_RESPONSE_SLOTS);
+        shard->peers[i].scratch.fd = -1;
+    }
+
+    shard->server = server;
+    server->shard = shard;
+    server->list = (shardOf("tasks", shards) == shard->index) ? group->mainList : NULL;
+    workspaceInit(&server->workspace, server->list,
+                  ((size_t)options->memoryBudgetMB << 20) / (size_t)shards);
+    server->handoffPhase = HANDOFF_NONE;
+    server->handoffFd = -1;
+    server->executor.eventFd = -1; // Saves run inline on the shard's thread.
+    server->replication.fd = -1;
+    for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        server->replication.followers[i].fd = -1;
+    }
+    for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+    server->listener = openListener(options->servePort, 1);
+    server->watchFd = watchTasksFile();
+    shard->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->listener < 0 || shard->eventFd < 0) {
+        printf("Error: Shard %d could not listen on 127.0.0.1:%d (%s).\n",
+               shard->index, options->servePort, strerror(errno));
+        group->failed = 1;
+    }
+
+    pthread_barrier_wait(&group->started);
+    if (shard->index == 0 && !group->failed) {
+        printf("Serving tasks on http://127.0.0.1:%d/ with %d shards (Ctrl-C to stop)\n",
+               options->servePort, shards);
+        fflush(stdout);
+    }
+
+    while (!stopRequested && !group->failed) {
+        int count = 0;
+        int timeout = SHARD_POLL_MS; // To notice a stop even when idle
+
+        fds[count].fd = (server->connections == HTTP_MAX_CLIENTS || server->readsPaused)
+                            ? -1 : server->listener;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        fds[count].fd = server->watchFd;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        fds[count].fd = shard->eventFd;
+        fds[count].events = POLLIN;
+        slots[count++] = -1;
+        for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+            HttpClient* client = &server->clients[i];
+            if (client->fd < 0) {
+                continue;
+            }
+            fds[count].fd = client->fd;
+            fds[count].events = httpClientEvents(server, client, 0);
+            slots[count++] = i;
+            if (client->queued + client->refused > 0 && client->outLen == client->outSent &&
+                !client->forwarded) {
+                timeout = 0;
+            }
+        }
+
+        if (poll(fds, count, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            httpAcceptClients(server);
+        }
+        if (fds[1].revents & POLLIN) {
+            workspaceReloadChanged(&server->workspace, server->watchFd);
+        }
+        if (fds[2].revents & POLLIN) {
+            unsigned long long ignored;
+            if (read(shard->eventFd, &ignored, sizeof(ignored)) < 0) {
+                // Nothing to clear; the queues are checked regardless.
+            }
+        }
+
+        // Other shards' requests for our lists, and their responses to ours.
+        for (i = 0; i < shards; i++) {
+            if (i != shard->index) {
+                shardServePeer(shard, i);
+                shardCollectResponses(shard, i);
+            }
+        }
+
+        for (i = 3; i < count; i++) {
+            HttpClient* client = &server->clients[slots[i]];
+            if (client->fd < 0 ||
+                (fds[i].revents == 0 && client->queued + client->refused == 0)) {
+                continue;
+            }
+            httpServiceClient(server, client, fds[i].revents);
+        }
+
+        if (server->workspace.loadedBytes > server->workspace.budget) {
+            workspaceEnforceBudget(&server->workspace);
+        }
+        if (server->queuedRequests >= HTTP_MAX_QUEUED) {
+            server->readsPaused = 1;
+        } else if (server->queuedRequests <= HTTP_MAX_QUEUED / 2) {
+            server->readsPaused = 0;
+        }
+        if (server->readsPaused) {
+            server->pausedTurns++;
+        }
+    }
+
+    for (i = 0; i < HTTP_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            httpReset(&server->clients[i]);
+        }
+    }
+    for (i = 0; i < shards; i++) {
+        httpReset(&shard->peers[i].scratch);
+    }
+    workspaceClose(&server->workspace);
+    if (server->list != NULL) {
+        saveTasks(server->list);
+    }
+    if (server->listener >= 0) {
+        close(server->listener);
+    }
+    if (server->watchFd >= 0) {
+        close(server->watchFd);
+    }
+
+    // Peers may still write to our queues and eventfd until they stop too.
+    pthread_barrier_wait(&group->stopped);
+    for (i = 0; i < shards; i++) {
+        shardQueueFree(group->requests[i * shards + shard->index]);
+        shardQueueFree(group->responses[i * shards + shard->index]);
+    }
+    if (shard->eventFd >= 0) {
+        close(shard->eventFd);
+    }
+    free(shard->peers);
+    free(server);
+    return NULL;
+}
+
+/**
+ * @brief Picks the shard that owns a list.
+ * @param name The list's name.
+ * @param count Number of shards.
+ * @return The owner's index.
+ */
+int shardOf(const char* name, int count) {
+    return (int)(hashLine(name, strlen(name)) % (unsigned long)count);
+}
+
+/**
+ * @brief Makes an empty queue.
+ * @param slotSize Bytes per message.
+ * @param slotCount Messages it holds (a power of two).
+ * @return The queue.
+ */
+ShardQueue* shardQueueCreate(size_t slotSize, unsigned long slotCount) {
+    ShardQueue* queue = (ShardQueue*)aligned_alloc(64, sizeof(ShardQueue));
+    if (queue == NULL) {
+        printf("Error: Could not allocate memory for a shard queue.\n");
+        exit(1);
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->slotSize = slotSize;
+    queue->slotCount = slotCount;
+    queue->slots = (char*)malloc(slotSize * slotCount);
+    if (queue->slots == NULL) {
+        printf("Error: Could not allocate memory for a shard queue.\n");
+        exit(1);
+    }
+    return queue;
+}
+
+/**
+ * @brief Frees a queue.
+ * @param queue The queue (NULL is fine).
+ */
+void shardQueueFree(ShardQueue* queue) {
+    if (queue != NULL) {
+        free(queue->slots);
+        free(queue);
+    }
+}
+
+/**
+ * @brief Producer: returns the next free slot, to fill in and publish.
+ * @param queue The queue.
+ * @return The slot, or NULL if the queue is full.
+ */
+void* shardQueueReserve(ShardQueue* queue) {
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    // Acquire: the consumer is done with the slot before we reuse it.
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (tail - head == queue->slotCount) {
+        return NULL;
+    }
+    return queue->slots + (tail & (queue->slotCount - 1)) * queue->slotSize;
+}
+
+/**
+ * @brief Producer: hands the slot from shardQueueReserve() to the consumer.
+ * @param queue The queue.
+ */
+void shardQueuePublish(ShardQueue* queue) {
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    // Release: the message is written before the consumer can see it.
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief Consumer: returns the oldest message, leaving it in the queue.
+ * @param queue The queue.
+ * @return The message, or NULL if the queue is empty.
+ */
+void* shardQueuePeek(ShardQueue* queue) {
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return queue->slots + (head & (queue->slotCount - 1)) * queue->slotSize;
+}
+
+/**
+ * @brief Consumer: frees the slot of the message from shardQueuePeek().
+ * @param queue The queue.
+ */
+void shardQueuePop(ShardQueue* queue) {
+    unsigned long head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Wakes a shard's loop to look at its queues.
+ * @param shard The shard.
+ */
+void shardWake(Shard* shard) {
+    unsigned long long one = 1;
+    if (write(shard->eventFd, &one, sizeof(one)) < 0) {
+        // The counter can't overflow in practice; the loop still wakes.
+    }
+}
+
+/**
+ * @brief Passes a request to the shard that owns its list. The connection
+ * waits (see httpPump()) until shardCollectResponses() has the response.
+ * @param client The connection.
+ * @param server This shard's server.
+ * @param list The list's name.
+ * @param method The request method.
+ * @param path The request target, less any /lists/NAME prefix.
+ * @param body The request body.
+ */
+void httpForward(HttpClient* client, Server* server, const char* list,
+                 const char* method, const char* path, const char* body) {
+    Shard* shard = server->shard;
+    ShardGroup* group = shard->group;
+    int owner = shardOf(list, group->count);
+    ShardQueue* queue = group->requests[shard->index * group->count + owner];
+    ShardRequest* request = (ShardRequest*)shardQueueReserve(queue);
+
+    if (request == NULL) {
+        // The owner is this far behind; shed, like a request queued too long.
+        server->shedRequests++;
+        httpRespond(client, "503 Service Unavailable", "{\"error\":\"overloaded\"}");
+        return;
+    }
+    request->slot = (int)(client - server->clients);
+    request->generation = client->generation;
+    request->keepAlive = client->keepAlive;
+    snprintf(request->method, sizeof(request->method), "%s", method);
+    snprintf(request->list, sizeof(request->list), "%s", list);
+    snprintf(request->path, sizeof(request->path), "%s", path);
+    snprintf(request->body, sizeof(request->body), "%s", body);
+    shardQueuePublish(queue);
+    shardWake(&group->shards[owner]);
+
+    client->forwarded = 1;
+    shard->forwardedRequests++;
+}
+
+/**
+ * @brief Runs another shard's requests for our lists and sends back the
+ * responses, as far as its response queue has room.
+ * @param shard This shard.
+ * @param from The other shard.
+ */
+void shardServePeer(Shard* shard, int from) {
+    ShardGroup* group = shard->group;
+    ShardQueue* requests = group->requests[from * group->count + shard->index];
+    ShardQueue* responses = group->responses[shard->index * group->count + from];
+    ShardPeer* peer = &shard->peers[from];
+    HttpClient* scratch = &peer->scratch;
+    Server* server = shard->server;
+    int sent = 0;
+
+    while (1) {
+        if (peer->busy) {
+            ShardResponse* response = (ShardResponse*)shardQueueReserve(responses);
+            if (response == NULL) {
+                break; // The peer wakes us when it has made room.
+            }
+            if (scratch->outLen == 0 && scratch->streaming) {
+                httpContinueListing(scratch);
+            }
+            response->slot = peer->slot;
+            response->generation = peer->generation;
+            response->length = scratch->outLen;
+            memcpy(response->data, scratch->out, scratch->outLen);
+            response->last = !scratch->streaming;
+            shardQueuePublish(responses);
+            scratch->outLen = 0;
+            peer->busy = !response->last;
+            sent = 1;
+            continue;
+        }
+
+        ShardRequest* request = (ShardRequest*)shardQueuePeek(requests);
+        if (request == NULL) {
+            break;
+        }
+        scratch->keepAlive = request->keepAlive;
+        scratch->outLen = 0;
+        scratch->outSent = 0;
+        peer->slot = request->slot;
+        peer->generation = request->generation;
+        TaskList* list = workspaceOpen(&server->workspace, request->list);
+        httpDispatchList(scratch, server, list, request->method, request->path, request->body);
+        workspaceTouch(&server->workspace, workspaceFind(&server->workspace, request->list, 0));
+        shardQueuePop(requests);
+        peer->busy = 1;
+        shard->servedRequests++;
+        server->handledRequests++;
+    }
+    if (sent) {
+        shardWake(&group->shards[from]);
+    }
+}
+
+/**
+ * @brief Hands responses from another shard to the connections waiting
+ * for them.
+ * @param shard This shard.
+ * @param from The other shard.
+ */
+void shardCollectResponses(Shard* shard, int from) {
+    ShardGroup* group = shard->group;
+    ShardQueue* responses = group->responses[from * group->count + shard->index];
+    Server* server = shard->server;
+    ShardResponse* response;
+    int popped = 0;
+
+    while ((response = (ShardResponse*)shardQueuePeek(responses)) != NULL) {
+        HttpClient* client = &server->clients[response->slot];
+        if (client->fd >= 0 && client->forwarded && client->generation == response->generation) {
+            if (HTTP_BUFFER_SIZE - client->outLen < response->length) {
+                break; // Wait until the connection has sent enough.
+            }
+            memcpy(client->out + client->outLen, response->data, response->length);
+            client->outLen += response->length;
+            if (response->last) {
+                client->forwarded = 0;
+            }
+        }
+        // Otherwise the connection closed meanwhile; drop it.
+        shardQueuePop(responses);
+        popped = 1;
+        if (client->fd >= 0 && httpPump(client, server) != 0) {
+            httpCloseClient(server, client);
+        }
+    }
+    if (popped) {
+        shardWake(&group->shards[from]); // It may be waiting for room.
+    }
+}
+
+// --- List Benchmarks ---
+//
+// ./todo --bench [MAX_TASKS] times each core list operation on lists of
+// 1,000 tasks, then 10x more each round up to MAX_TASKS, and prints one
+// JSON object per operation and size:
+//
+//   {"op":"add","tasks":100000,"ops":100000,"ns_per_op":248.8,
+//    "ops_per_sec":4019550,"peak_rss_kb":31372}
+//
+// 'ops' is how many calls (or, for display/save/load/free, tasks) the
+// time covers. Mark and delete take an index and walk the list to it, so
+// their ns_per_op grows with 'tasks'; the rest should stay flat. Output
+// the operations themselves print goes to /dev/null while they're timed.
+//
+// With --counters, each line also has hardware counts per op, from
+// perf_event_open (user space only): cycles_per_op, instructions_per_op,
+// l1d_misses_per_op, llc_misses_per_op and branch_misses_per_op. Counters
+// the kernel doesn't allow (see /proc/sys/kernel/perf_event_paranoid) or
+// the CPU doesn't have are left out, and the timings are still printed.
+
+/**
+ * @brief Runs the list benchmarks and prints the results.
+ * @param maxTasks Largest list size to time.
+ * @param useCounters Also read hardware performance counters.
+ * @return 0 on success, 1 on a bad size.
+ */
+int runListBench(long maxTasks, int useCounters) {
+    PerfCounters counters;
+    long tasks;
+    int i;
+
+    if (maxTasks < 1000) {
+        printf("Error: --bench needs at least 1000 tasks.\n");
+        return 1;
+    }
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        counters.fds[i] = -1;
+    }
+    if (useCounters && perfCountersOpen(&counters) == 0) {
+        fprintf(stderr, "Warning: No hardware counters available (%s); timing only.\n",
+                strerror(errno));
+    }
+    for (tasks = 1000; tasks <= maxTasks; tasks *= 10) {
+        benchListSize(tasks, &counters);
+    }
+    perfCountersClose(&counters);
+    unlink(BENCH_FILE);
+    return 0;
+}
+
+/**
+ * @brief Times every list operation at one list size.
+ * @param tasks The list size.
+ * @param counters Hardware counters to read around each operation.
+ */
+void benchListSize(long tasks, PerfCounters* counters) {
+    char description[MAX_TASK_LEN];
+    // Mark and delete walk the list, so time fewer of them on big lists
+    // (and never delete more than half of it).
+    long indexed = BENCH_INDEXED_WORK / tasks < tasks / 2 ? BENCH_INDEXED_WORK / tasks : tasks / 2;
+    Task** created;
+    TaskList list;
+    long long start;
+    long i;
+    int saved;
+
+    initList(&list);
+    setListFile(&list, BENCH_FILE);
+
+    // createTask: allocate and fill (frees aren't timed).
+    created = (Task**)malloc((size_t)tasks * sizeof(Task*));
+    if (created == NULL) {
+        printf("Error: Could not allocate memory for the benchmark.\n");
+        exit(1);
+    }
+    resetPeakRss();
+    start = benchStart(counters);
+    for (i = 0; i < tasks; i++) {
+        created[i] = createTask("Benchmark task");
+    }
+    benchReport("create", tasks, tasks, benchStop(counters, start), counters);
+    for (i = 0; i < tasks; i++) {
+        destroyTask(created[i]);
+    }
+    free(created);
+
+    // addTask: append to the end.
+    resetPeakRss();
+    start = benchStart(counters);
+    for (i = 0; i < tasks; i++) {
+        snprintf(description, sizeof(description), "Benchmark task %ld", i);
+        addTask(&list, description);
+    }
+    benchReport("add", tasks, tasks, benchStop(counters, start), counters);
+
+    // displayTasks: one listing of the whole list.
+    resetPeakRss();
+    saved = quietStdout();
+    start = benchStart(counters);
+    displayTasks(&list);
+    fflush(stdout);
+    long long nanos = benchStop(counters, start);
+    restoreStdout(saved);
+    benchReport("display", tasks, tasks, nanos, counters);
+
+    // markComplete: indices spread over the whole list.
+    resetPeakRss();
+    saved = quietStdout();
+    start = benchStart(counters);
+    for (i = 0; i < indexed; i++) {
+        markComplete(&list, (int)(1 + (i * (tasks - 1)) / indexed));
+    }
+    fflush(stdout);
+    nanos = benchStop(counters, start);
+    restoreStdout(saved);
+    benchReport("mark", tasks, indexed, nanos, counters);
+
+    // saveTasks and loadTasks: the whole list, through BENCH_FILE.
+    resetPeakRss();
+    start = benchStart(counters);
+    saveTasks(&list);
+    benchReport("save", tasks, tasks, benchStop(counters, start), counters);
+
+    // Churn: delete the first task and add one at the end, over and over,
+    // so every add can reuse what the delete just freed.
+    resetPeakRss();
+    saved = quietStdout();
+    start = benchStart(counters);
+    for (i = 0; i < tasks; i++) {
+        deleteTask(&list, 1);
+        snprintf(description, sizeof(description), "Churned task %ld", i);
+        addTask(&list, description);
+    }
+    fflush(stdout);
+    nanos = benchStop(counters, start);
+    restoreStdout(saved);
+    benchReport("churn", tasks, tasks, nanos, counters);
+
+    // deleteTask: indices spread over what's left.
+    resetPeakRss();
+    saved = quietStdout();
+    start = benchStart(counters);
+    for (i = 0; i < indexed; i++) {
+        deleteTask(&list, (int)(1 + (i * (list.count - 1)) / indexed));
+    }
+    fflush(stdout);
+    nanos = benchStop(counters, start);
+    restoreStdout(saved);
+    benchReport("delete", tasks, indexed, nanos, counters);
+
+    // freeList: what's left.
+    long left = list.count;
+    resetPeakRss();
+    start = benchStart(counters);
+    freeList(&list);
+    benchReport("free", tasks, left, benchStop(counters, start), counters);
+
+    initList(&list);
+    setListFile(&list, BENCH_FILE);
+    resetPeakRss();
+    saved = quietStdout();
+    start = benchStart(counters);
+    loadTasks(&list);
+    fflush(stdout);
+    nanos = benchStop(counters, start);
+    restoreStdout(saved);
+    benchReport("load", tasks, tasks, nanos, counters);
+    freeList(&list);
+
+    benchBatches(tasks, indexed, counters);
+}
+
+/**
+ * @brief Times the batch operations at one list size, to compare with
+ * the one-at-a-time ones benchListSize() times: adds, marks and deletes
+ * BENCH_BATCH_SIZE at a time, and adds written to the file per task
+ * versus per batch.
+ * @param tasks The list size.
+ * @param indexed How many tasks the mark and delete benchmarks change.
+ * @param counters Hardware counters to read around each operation.
+ */
+void benchBatches(long tasks, long indexed, PerfCounters* counters) {
+    char (*texts)[48] = (char (*)[48])malloc(BENCH_BATCH_SIZE * sizeof(*texts));
+    TextView* views = (TextView*)malloc(BENCH_BATCH_SIZE * sizeof(TextView));
+    int* indices = (int*)malloc(BENCH_BATCH_SIZE * sizeof(int));
+    TaskList list;
+    long long start;
+    long done;
+    long i;
+    int size;
+
+    if (texts == NULL || views == NULL || indices == NULL) {
+        printf("Error: Could not allocate memory for the benchmark.\n");
+        exit(1);
+    }
+
+    // addTasks: the same tasks as the "add" benchmark, a batch at a time.
+    initList(&list);
+    setListFile(&list, BENCH_FILE);
+    resetPeakRss();
+    start = benchStart(counters);
+    for (done = 0; done < tasks; done += size) {
+        size = tasks - done < BENCH_BATCH_SIZE ? (int)(tasks - done) : BENCH_BATCH_SIZE;
+        for (i = 0; i < size; i++) {
+            views[i].text = texts[i];
+            views[i].length = (size_t)snprintf(texts[i], sizeof(texts[i]), "Benchmark task %ld",
+                                               done + i);
+        }
+        addTasks(&list, views, size);
+    }
+    benchReport("add_batch", tasks, tasks, benchStop(counters, start), counters);
+
+    // completeTasks and removeTasks: the "mark" and "delete" indices.
+    resetPeakRss();
+    start = benchStart(counters);
+    for (done = 0; done < indexed; done += size) {
+        size = indexed - done < BENCH_BATCH_SIZE ? (int)(indexed - done) : BENCH_BATCH_SIZE;
+        for (i = 0; i < size; i++) {
+            indices[i] = (int)(1 + ((done + i) * (tasks - 1)) / indexed);
+        }
+        completeTasks(&list, indices, size);
+    }
+    benchReport("mark_batch", tasks, indexed, benchStop(counters, start), counters);
+
+    resetPeakRss();
+    start = benchStart(counters);
+    for (done = 0; done < indexed; done += size) {
+        long count = list.count;
+        size = indexed - done < BENCH_BATCH_SIZE ? (int)(indexed - done) : BENCH_BATCH_SIZE;
+        for (i = 0; i < size; i++) {
+            indices[i] = (int)(1 + (i * (count - 1)) / size);
+        }
+        removeTasks(&list, indices, size);
+    }
+    benchReport("delete_batch", tasks, indexed, benchStop(counters, start), counters);
+    freeList(&list);
+
+    // Adds made durable: one appendTasks() (one write) per task...
+    initList(&list);
+    setListFile(&list, BENCH_FILE);
+    writeTasks(&list);
+    resetPeakRss();
+    start = benchStart(counters);
+    for (i = 0; i < tasks; i++) {
+        snprintf(texts[0], sizeof(texts[0]), "Benchmark task %ld", i);
+        addTask(&list, texts[0]);
+        appendTasks(&list, list.tail);
+    }
+    benchReport("add_journal", tasks, tasks, benchStop(counters, start), counters);
+    freeList(&list);
+
+    // ...and one per batch.
+    initList(&list);
+    setListFile(&list, BENCH_FILE);
+    writeTasks(&list);
+    resetPeakRss();
+    start = benchStart(counters);
+    for (done = 0; done < tasks; done += size) {
+        size = tasks - done < BENCH_BATCH_SIZE ? (int)(tasks - done) : BENCH_BATCH_SIZE;
+        for (i = 0; i < size; i++) {
+            views[i].text = texts[i];
+            views[i].length = (size_t)snprintf(texts[i], sizeof(texts[i]), "Benchmark task %ld",
+                                               done + i);
+        }
+        appendTasks(&list, addTasks(&list, views, size));
+    }
+    benchReport("add_batch_journal", tasks, tasks, benchStop(counters, start), counters);
+    freeList(&list);
+
+    free(texts);
+    free(views);
+    free(indices);
+}
+
+/**
+ * @brief Prints one benchmark result as a JSON line.
+ * @param op The operation's name.
+ * @param tasks The list size.
+ * @param ops How many calls (or tasks) the time covers.
+ * @param nanos The time taken.
+ * @param counters Hardware counts for the same span (unopened ones are
+ * skipped), and the description bytes copied.
+ */
+void benchReport(const char* op, long tasks, long ops, long long nanos,
+                 const PerfCounters* counters) {
+    static const char* const names[PERF_COUNTERS] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+    };
+    double perOp = ops > 0 ? (double)nanos / ops : 0.0;
+    int i;
+
+    printf("{\"op\":\"%s\",\"tasks\":%ld,\"ops\":%ld,\"ns_per_op\":%.1f,"
+           "\"ops_per_sec\":%.0f,\"peak_rss_kb\":%ld,\"bytes_copied_per_op\":%.1f,"
+           "\"build\":\"%s\",\"allocator\":\"%s\"",
+           op, tasks, ops, perOp, perOp > 0 ? 1e9 / perOp : 0.0, peakRssKb(),
+           ops > 0 ? (double)counters->copied / ops : 0.0, buildPolicies(), memoryResource->name);
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) {
+            printf(",\"%s_per_op\":%.2f", names[i],
+                   ops > 0 ? (double)counters->values[i] / ops : 0.0);
+        }
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+/**
+ * @brief Starts timing (and counting) a benchmarked operation.
+ * @param counters The hardware counters.
+ * @return The start time, for benchStop().
+ */
+long long benchStart(PerfCounters* counters) {
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    counters->copied = __atomic_load_n(&memoryStats.bytesCopied, __ATOMIC_RELAXED);
+    return nowNanos();
+}
+
+/**
+ * @brief Stops timing (and counting) a benchmarked operation.
+ * @param counters The hardware counters; their values are filled in.
+ * @param start What benchStart() returned.
+ * @return Nanoseconds since benchStart().
+ */
+long long benchStop(PerfCounters* counters, long long start) {
+    long long nanos = nowNanos() - start;
+    int i;
+
+    counters->copied = __atomic_load_n(&memoryStats.bytesCopied, __ATOMIC_RELAXED) -
+                       counters->copied;
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        counters->values[i] = 0;
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counters->fds[i], &counters->values[i], sizeof(counters->values[i])) !=
+                (ssize_t)sizeof(counters->values[i])) {
+                counters->values[i] = 0;
+            }
+        }
+    }
+    return nanos;
+}
+
+/**
+ * @brief Opens the hardware counters for this process, user space only,
+ * disabled until benchStart().
+ * @param counters Receives the descriptors (-1 for each one not available).
+ * @return How many could be opened.
+ */
+int perfCountersOpen(PerfCounters* counters) {
+    static const struct { unsigned type; unsigned long long config; } events[PERF_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+    int opened = 0;
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (counters->fds[i] >= 0) {
+            opened++;
+        }
+    }
+    return opened;
+}
+
+/**
+ * @brief Closes the hardware counters.
+ * @param counters The counters.
+ */
+void perfCountersClose(PerfCounters* counters) {
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+            counters->fds[i] = -1;
+        }
+    }
+}
+
+/**
+ * @brief Sends stdout to /dev/null, for timing functions that print.
+ * @return The real stdout, for restoreStdout() (-1 if it couldn't be saved).
+ */
+int quietStdout(void) {
+    int saved;
+    int null;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (saved >= 0 && null >= 0) {
+        dup2(null, STDOUT_FILENO);
+    }
+    if (null >= 0) {
+        close(null);
+    }
+    return saved;
+}
+
+/**
+ * @brief Undoes quietStdout().
+ * @param saved What quietStdout() returned.
+ */
+void restoreStdout(int saved) {
+    fflush(stdout);
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+/**
+ * @brief Starts a new peak-RSS measurement, where the kernel allows it
+ * (Linux 4.0 and later). Elsewhere the peak is the process's lifetime peak.
+ */
+void resetPeakRss(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) < 0) {
+            // Not allowed here; peakRssKb() reports the lifetime peak.
+        }
+        close(fd);
+    }
+}
+
+/**
+ * @brief Returns the peak resident set size since resetPeakRss().
+ * @return Kilobytes.
+ */
+long peakRssKb(void) {
+    FILE* status = fopen("/proc/self/status", "r");
+    char line[256];
+    long peak = -1;
+
+    while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            peak = atol(line + 6);
+            break;
+        }
+    }
+    if (status != NULL) {
+        fclose(status);
+    }
+    if (peak < 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+    return peak;
+}
+
+// --- Synthetic Workloads ---
+//
+// Deterministic test data, so a benchmark can be re-run on exactly the
+// same input: the same seed always gives the same files.
+//
+// --generate-tasks FILE COUNT writes a task file in the tasks.txt format.
+// Descriptions are made of words, with lengths skewed like real lists:
+// mostly short, some long, a few near MAX_TASK_LEN. --completed PCT of
+// them are marked done.
+//
+// --generate-ops FILE COUNT writes an operation stream, one per line:
+//
+//   add <description>
+//   mark <index>
+//   delete <index>
+//   search <text>
+//   list
+//   save
+//
+// Indexes are 1-based and valid for the list as it is when the line runs,
+// given that it started with --start-tasks N tasks. --batch FILE runs such
+// a stream against the list (tasks.txt), then saves it.
+
+// Words generated descriptions are made of.
+static const char* const workloadWords[] = {
+    "buy", "milk", "call", "mom", "fix", "bug", "in", "the", "parser", "review",
+    "pull", "request", "for", "release", "write", "report", "plan", "sprint",
+    "meeting", "with", "team", "update", "docs", "clean", "kitchen", "pay",
+    "rent", "book", "flight", "to", "Berlin", "renew", "passport", "order",
+    "groceries", "email", "landlord", "about", "heating", "refactor", "login",
+    "flow", "prepare", "slides", "quarterly", "numbers", "water", "plants"
+};
+
+/**
+ * @brief Returns the next number from a seeded generator (splitmix64).
+ * @param state The generator's state; start it at the seed.
+ * @return 64 random bits.
+ */
+unsigned long long nextRandom(unsigned long long* state) {
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Makes up a task description of a skewed random length:
+ * 60% up to 30 characters, 30% up to 80, 9% up to 200, 1% up to the limit.
+ * @param state The generator's state.
+ * @param out Where to write.
+ * @param room Bytes available at 'out' (at least MAX_TASK_LEN).
+ */
+void randomDescription(unsigned long long* state, char* out, size_t room) {
+    unsigned long long roll = nextRandom(state) % 100;
+    size_t low = roll < 60 ? 8 : roll < 90 ? 30 : roll < 99 ? 80 : 200;
+    size_t high = roll < 60 ? 30 : roll < 90 ? 80 : roll < 99 ? 200 : MAX_TASK_LEN - 1;
+    size_t length = low + nextRandom(state) % (high - low + 1);
+    size_t words = sizeof(workloadWords) / sizeof(workloadWords[0]);
+    size_t used = 0;
+
+    if (length >= room) {
+        length = room - 1;
+    }
+    while (used < length) {
+        const char* word = workloadWords[nextRandom(state) % words];
+        size_t wordLength = strlen(word);
+        if (used > 0) {
+            out[used++] = ' ';
+        }
+        if (used + wordLength > length) {
+            wordLength = length - used;
+        }
+        memcpy(out + used, word, wordLength);
+        used += wordLength;
+    }
+    // Never end on the space (it would be lost when read back).
+    while (used > 0 && out[used - 1] == ' ') {
+        used--;
+    }
+    out[used] = '\0';
+}
+
+/**
+ * @brief Writes a synthetic task file.
+ * @param path The file to write.
+ * @param count How many tasks.
+ * @param seed Seed for the generator.
+ * @param completedPercent Share of tasks marked done (0-100).
+ * @return 0 on success, 1 on error.
+ */
+int generateTaskFile(const char* path, long count, unsigned long long seed, int completedPercent) {
+    unsigned long long state = seed;
+    char description[MAX_TASK_LEN];
+    FILE* file;
+    long i;
+
+    if (count < 0) {
+        printf("Error: Need a task count of 0 or more.\n");
+        return 1;
+    }
+    file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Error: Could not open file %s for writing.\n", path);
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        int completed = (int)(nextRandom(&state) % 100) < completedPercent;
+        randomDescription(&state, description, sizeof(description));
+        fprintf(file, "%d,%s\n", completed, description);
+    }
+    if (fclose(file) != 0) {
+        printf("Error: Could not write %s (%s).\n", path, strerror(errno));
+        return 1;
+    }
+    printf("Wrote %ld tasks to %s (seed %llu).\n", count, path, seed);
+    return 0;
+}
+
+/**
+ * @brief Writes a synthetic operation stream for --batch: 40% add,
+ * 25% mark, 20% delete, 9% search, 5% list, 1% save.
+ * @param path The file to write.
+ * @param count How many operations.
+ * @param seed Seed for the generator.
+ * @param startTasks Tasks in the list the stream will run against.
+ * @return 0 on success, 1 on error.
+ */
+int generateOpStream(const char* path, long count, unsigned long long seed, long startTasks) {
+    size_t words = sizeof(workloadWords) / sizeof(workloadWords[0]);
+    unsigned long long state = seed;
+    char description[MAX_TASK_LEN];
+    long tasks = startTasks; // The list's size at this point in the stream
+    FILE* file;
+    long i;
+
+    if (count < 0) {
+        printf("Error: Need an operation count of 0 or more.\n");
+        return 1;
+    }
+    file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Error: Could not open file %s for writing.\n", path);
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        unsigned long long roll = nextRandom(&state) % 100;
+        if (roll < 40 || tasks == 0) {
+            randomDescription(&state, description, sizeof(description));
+            fprintf(file, "add %s\n", description);
+            tasks++;
+        } else if (roll < 65) {
+            fprintf(file, "mark %llu\n", 1 + nextRandom(&state) % (unsigned long long)tasks);
+        } else if (roll < 85) {
+            fprintf(file, "delete %llu\n", 1 + nextRandom(&state) % (unsigned long long)tasks);
+            tasks--;
+        } else if (roll < 94) {
+            fprintf(file, "search %s\n", workloadWords[nextRandom(&state) % words]);
+        } else if (roll < 99) {
+            fprintf(file, "list\n");
+        } else {
+            fprintf(file, "save\n");
+        }
+    }
+    if (fclose(file) != 0) {
+        printf("Error: Could not write %s (%s).\n", path, strerror(errno));
+        return 1;
+    }
+    printf("Wrote %ld operations to %s (seed %llu, starting from %ld tasks).\n",
+           count, path, seed, startTasks);
+    return 0;
+}
+
+/**
+ * @brief Runs an operation stream (see --generate-ops) or a session
+ * trace (see --record) against a list, then saves it. The operations
+ * print what they would in the menu; a summary goes to stderr.
+ * @param list The list (already loaded).
+ * @param path The stream's file, or "-" for stdin.
+ * @param timed Also time each command (--replay): print one line per
+ * command and a per-operation summary to stderr.
+ * @return 0 on success, 1 if the file couldn't be read.
+ */
+int runBatch(TaskList* list, const char* path, int timed) {
+    static const char* const names[] = { "add", "mark", "delete", "search", "list", "save" };
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char line[MAX_TASK_LEN + 40];
+    long count[6] = { 0 };
+    long long total[6] = { 0 };
+    long long slowest[6] = { 0 };
+    long lineNumber = 0;
+    long ops = 0;
+    long long start;
+    int index;
+    int op;
+
+    if (file == NULL) {
+        printf("Error: Could not open file %s for reading.\n", path);
+        return 1;
+    }
+
+    start = nowNanos();
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* command = line;
+        lineNumber++;
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        // A trace starts each line with when it was recorded; replays
+        // run at full speed, so skip it.
+        if (isdigit((unsigned char)command[0])) {
+            strtod(command, &command);
+            command += strspn(command, " ");
+        }
+
+        TRACE_SPAN("batch command");
+        long long began = nowNanos();
+        if (strncmp(command, "add ", 4) == 0) {
+            addTask(list, command + 4);
+            op = 0;
+        } else if (sscanf(command, "mark %d", &index) == 1) {
+            markComplete(list, index);
+            op = 1;
+        } else if (sscanf(command, "delete %d", &index) == 1) {
+            deleteTask(list, index);
+            op = 2;
+        } else if (strncmp(command, "search ", 7) == 0) {
+            searchTasks(list, command + 7);
+            op = 3;
+        } else if (strcmp(command, "list") == 0) {
+            displayTasks(list);
+            op = 4;
+        } else if (strcmp(command, "save") == 0) {
+            saveTasks(list);
+            op = 5;
+        } else {
+            printf("Error: Line %ld: unknown operation '%s'.\n", lineNumber, command);
+            continue;
+        }
+        ops++;
+
+        if (timed) {
+            long long latency = nowNanos() - began;
+            count[op]++;
+            total[op] += latency;
+            if (latency > slowest[op]) {
+                slowest[op] = latency;
+            }
+            fflush(stdout);
+            fprintf(stderr, "replay: line=%ld op=%s tasks=%d latency_us=%.1f\n",
+                    lineNumber, names[op], list->count, latency / 1e3);
+        }
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    saveTasks(list);
+
+    long long elapsed = nowNanos() - start;
+    fflush(stdout);
+    for (op = 0; timed && op < 6; op++) {
+        if (count[op] > 0) {
+            fprintf(stderr, "replay: op=%s count=%ld mean_us=%.1f max_us=%.1f\n",
+                    names[op], count[op], total[op] / 1e3 / count[op], slowest[op] / 1e3);
+        }
+    }
+    fprintf(stderr, "%s: ops=%ld seconds=%.3f ops_per_sec=%.0f tasks=%d\n",
+            timed ? "replay" : "batch", ops, elapsed / 1e9,
+            elapsed > 0 ? ops / (elapsed / 1e9) : 0.0, list->count);
+    return 0;
+}
+
+/**
+ * @brief Logs one menu command to a session trace, with the seconds
+ * since the session started.
+ * @param trace The trace (NULL = not recording; does nothing).
+ * @param sessionStart nowNanos() at startup.
+ * @param format printf-style command text.
+ */
+void recordCommand(FILE* trace, long long sessionStart, const char* format, ...) {
+    va_list arguments;
+
+    if (trace == NULL) {
+        return;
+    }
+    fprintf(trace, "%.6f ", (nowNanos() - sessionStart) / 1e9);
+    va_start(arguments, format);
+    vfprintf(trace, format, arguments);
+    va_end(arguments);
+    fputc('\n', trace);
+    fflush(trace); // Keep the trace if the session is killed.
+}
+
+// --- Latency Histograms ---
+//
+// addTask, displayTasks, completeTask, removeTask, loadTasks and saveTasks
+// each time themselves with LATENCY_SCOPE into one histogram per
+// operation. Menu option 7 prints the percentiles, and they're printed to
+// stderr when the program exits. The histograms are shared by every
+// thread (--threads), so they're updated with relaxed atomics.
+
+static LatencyHistogram latencyHistograms[LATENCY_OPS];
+static __thread int latencyDepth; // Timed operations running on this thread
+
+static const char* const latencyNames[LATENCY_OPS] = {
+    "add", "list", "mark", "delete", "load", "save"
+};
+
+/**
+ * @brief Starts timing an operation (use LATENCY_SCOPE rather than this).
+ * @param op The operation.
+ * @return The scope, for latencyStop().
+ */
+LatencyScope latencyStart(LatencyOp op) {
+    LatencyScope scope;
+    scope.op = op;
+    scope.started = (latencyDepth++ == 0) ? nowNanos() : 0;
+    return scope;
+}
+
+/**
+ * @brief Stops timing an operation and records it, unless it ran inside
+ * another timed operation. Called by the cleanup attribute.
+ * @param scope The scope from latencyStart().
+ */
+void latencyStop(LatencyScope* scope) {
+    int error = errno; // Runs after the timed function's return: keep its errno
+
+    latencyDepth--;
+    if (scope->started != 0) {
+        long long nanos = nowNanos() - scope->started;
+        latencyRecord(&latencyHistograms[scope->op], nanos);
+        metricAdd((Metric)(METRIC_OP_ADD + scope->op), 1);
+        traceRecord(latencyNames[scope->op], scope->started, nanos); // If tracing
+    }
+    errno = error;
+}
+
+/**
+ * @brief Adds one measurement to a histogram.
+ * @param histogram The histogram.
+ * @param nanos The latency.
+ */
+void latencyRecord(LatencyHistogram* histogram, long long nanos) {
+    long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+    if (nanos < 0) {
+        nanos = 0;
+    }
+    __atomic_fetch_add(&histogram->counts[latencyBucket((unsigned long long)nanos)], 1,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, nanos, __ATOMIC_RELAXED);
+    while (nanos > max &&
+           !__atomic_compare_exchange_n(&histogram->max, &max, nanos, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief Finds the bucket a latency falls in.
+ * @param nanos The latency.
+ * @return The bucket's index.
+ */
+int latencyBucket(unsigned long long nanos) {
+    if (nanos < 2 * LATENCY_HALF) {
+        return (int)nanos;
+    }
+    // Keep the top LATENCY_SUB_BITS bits: nanos >> shift is in
+    // [LATENCY_HALF, 2 * LATENCY_HALF).
+    int shift = (63 - __builtin_clzll(nanos)) - (LATENCY_SUB_BITS - 1);
+    return shift * LATENCY_HALF + (int)(nanos >> shift);
+}
+
+/**
+ * @brief Returns the largest latency that falls in a bucket.
+ * @param bucket The bucket's index.
+ * @return Nanoseconds.
+ */
+long long latencyBucketValue(int bucket) {
+    if (bucket < 2 * LATENCY_HALF) {
+        return bucket;
+    }
+    int shift = bucket / LATENCY_HALF - 1;
+    long long mantissa = bucket - shift * LATENCY_HALF;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * @brief Returns the latency that a given share of measurements are at
+ * or below.
+ * @param histogram The histogram.
+ * @param percentile 0 to 100.
+ * @return Nanoseconds (0 if the histogram is empty).
+ */
+long long latencyPercentile(const LatencyHistogram* histogram, double percentile) {
+    unsigned long rank = (unsigned long)(percentile / 100.0 * histogram->count + 0.5);
+    unsigned long seen = 0;
+    int bucket;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen >= rank) {
+            long long value = latencyBucketValue(bucket);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/**
+ * @brief Prints count, mean, percentiles and max of every operation that
+ * has run, in microseconds.
+ * @param out Where to print.
+ */
+void printLatencyStats(FILE* out) {
+    int op;
+    int any = 0;
+
+    fprintf(out, "\n--- Timing (microseconds) ---\n");
+    fprintf(out, "%-7s %10s %10s %10s %10s %10s %10s %10s\n",
+            "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (op = 0; op < LATENCY_OPS; op++) {
+        const LatencyHistogram* histogram = &latencyHistograms[op];
+        if (histogram->count == 0) {
+            continue;
+        }
+        fprintf(out, "%-7s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                latencyNames[op], histogram->count,
+                (double)histogram->sum / histogram->count / 1e3,
+                latencyPercentile(histogram, 50) / 1e3,
+                latencyPercentile(histogram, 90) / 1e3,
+                latencyPercentile(histogram, 99) / 1e3,
+                latencyPercentile(histogram, 99.9) / 1e3,
+                histogram->max / 1e3);
+        any = 1;
+    }
+    if (!any) {
+        fprintf(out, "Nothing timed yet.\n");
+    }
+}
+
+/**
+ * @brief atexit() handler: prints the timings to stderr, if anything ran.
+ */
+void dumpLatencyStats(void) {
+    int op;
+
+    for (op = 0; op < LATENCY_OPS; op++) {
+        if (latencyHistograms[op].count > 0) {
+            fflush(stdout);
+            printLatencyStats(stderr);
+            return;
+        }
+    }
+}
+
+// --- Memory Report ---
+
+/**
+ * @brief Prints where the memory goes (menu option 8): task records and
+ * the fixed-size description padding inside them, the list's other
+ * tables, and how much of the heap is in use versus held free.
+ * @param out Where to print.
+ * @param list The list.
+ */
+void printMemoryReport(FILE* out, const TaskList* list) {
+    unsigned long created = __atomic_load_n(&memoryStats.tasksCreated, __ATOMIC_RELAXED);
+    unsigned long destroyed = __atomic_load_n(&memoryStats.tasksDestroyed, __ATOMIC_RELAXED);
+    unsigned long long text = __atomic_load_n(&memoryStats.descriptionBytes, __ATOMIC_RELAXED);
+    unsigned long long copied = __atomic_load_n(&memoryStats.bytesCopied, __ATOMIC_RELAXED);
+    unsigned long live = created - destroyed;
+#if TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT
+    unsigned long long recordBytes = (unsigned long long)live * sizeof(Task) + text;
+    unsigned long long padding = 0; // Descriptions are sized to fit.
+#else
+    unsigned long long recordBytes = (unsigned long long)live * sizeof(Task);
+    unsigned long long padding = (unsigned long long)live * MAX_TASK_LEN - text;
+#endif
+    // Only malloc's blocks can be asked their usable size.
+    size_t usable = list->head != NULL && memoryResource->allocate == mallocAllocate
+                        ? malloc_usable_size(list->head) : 0;
+    struct mallinfo2 heap = mallinfo2();
+    size_t heapHeld = heap.arena + heap.hblkhd;
+
+    fprintf(out, "\n--- Memory (%s) ---\n", buildPolicies());
+    fprintf(out, "Tasks: %lu live (%lu created, %lu freed); this list has %d, "
+            "plus %d old versions kept for snapshots\n",
+            live, created, destroyed, list->count, list->garbage);
+    fprintf(out, "Task records: %llu bytes (%zu each%s", recordBytes, sizeof(Task),
+            TODO_DESCRIPTION == TODO_DESCRIPTION_EXACT ? ", plus the text" : "");
+    if (usable > 0 && TODO_DESCRIPTION == TODO_DESCRIPTION_INLINE) {
+        fprintf(out, "; malloc gives %zu usable, so about %llu bytes of allocator slack",
+                usable, (unsigned long long)live * (usable - sizeof(Task)));
+    }
+    fprintf(out, ")\n");
+    fprintf(out, "Descriptions: %llu bytes of text, %llu bytes of unused padding "
+            "(%.1f%% of the records)\n",
+            text, padding, recordBytes > 0 ? 100.0 * padding / recordBytes : 0.0);
+    fprintf(out, "Copies: %llu description bytes copied into tasks (%.1f per task made)\n",
+            copied, created > 0 ? (double)copied / created : 0.0);
+    fprintf(out, "Line index: %zu bytes (%d of %d entries used)\n",
+            (size_t)list->lineCapacity * sizeof(LineRecord), list->lineCount,
+            list->lineCapacity);
+    fprintf(out, "Snapshot table: %zu bytes\n",
+            (size_t)list->snapshotCapacity * sizeof(unsigned long));
+    fprintf(out, "Allocator (%s): %llu bytes held for tasks and indexes, %llu handed out\n",
+            memoryResource->name,
+            __atomic_load_n(&memoryResource->reserved, __ATOMIC_RELAXED),
+            __atomic_load_n(&memoryResource->inUse, __ATOMIC_RELAXED));
+    fprintf(out, "Heap: %zu bytes held, %zu in use, %zu free inside it "
+            "(%.1f%% fragmentation), %zu in mmapped blocks\n",
+            heapHeld, heap.uordblks + heap.hblkhd, heap.fordblks,
+            heap.arena > 0 ? 100.0 * heap.fordblks / heap.arena : 0.0, heap.hblkhd);
+    fprintf(out, "Resident: %ld KB now, %ld KB at peak\n", currentRssKb(), peakRssKb());
+}
+
+/**
+ * @brief Returns the current resident set size.
+ * @return Kilobytes (-1 if unknown).
+ */
+long currentRssKb(void) {
+    FILE* status = fopen("/proc/self/status", "r");
+    char line[256];
+    long rss = -1;
+
+    while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = atol(line + 6);
+            break;
+        }
+    }
+    if (status != NULL) {
+        fclose(status);
+    }
+    return rss;
+}
+
+// --- Tracing ---
+//
+// ./todo --trace FILE ... records spans (TRACE_SPAN, plus every operation
+// timed with LATENCY_SCOPE) into a ring buffer per thread, and writes
+// them to FILE as Chrome trace JSON at exit, from menu option 9, or on
+// POST /trace. Open the file in Perfetto (ui.perfetto.dev) or
+// chrome://tracing. Without --trace a span costs one test of a global.
+
+static int traceEnabled;                 // --trace was given
+static const char* traceFile;            // ...with this file
+static TraceRing* traceRings;            // Every thread's ring
+static pthread_mutex_t traceRingsLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TraceRing* traceRing;    // This thread's ring (made on first use)
+
+/**
+ * @brief Turns tracing on. Call before starting any threads.
+ * @param path Where writeTrace() writes by default, and where the
+ * trace goes at exit.
+ */
+void startTracing(const char* path) {
+    traceFile = path;
+    traceEnabled = 1;
+    atexit(writeTraceAtExit);
+}
+
+/**
+ * @brief Starts a span (use TRACE_SPAN rather than this).
+ * @param name The span's name (a string literal).
+ * @return The span, for traceEnd().
+ */
+TraceSpan traceBegin(const char* name) {
+    TraceSpan span;
+    span.name = name;
+    span.started = traceEnabled ? nowNanos() : 0;
+    return span;
+}
+
+/**
+ * @brief Ends a span and records it. Called by the cleanup attribute.
+ * @param span The span from traceBegin().
+ */
+void traceEnd(TraceSpan* span) {
+    if (span->started != 0) {
+        traceRecord(span->name, span->started, nowNanos() - span->started);
+    }
+}
+
+/**
+ * @brief Records a finished span in this thread's ring.
+ * @param name The span's name (a string literal).
+ * @param start When it started (nowNanos()).
+ * @param duration How long it took, in nanoseconds.
+ */
+void traceRecord(const char* name, long long start, long long duration) {
+    if (!traceEnabled) {
+        return;
+    }
+    if (traceRing == NULL) {
+        traceRing = (TraceRing*)calloc(1, sizeof(TraceRing));
+        if (traceRing == NULL) {
+            printf("Error: Could not allocate memory for tracing.\n");
+            exit(1);
+        }
+        traceRing->tid = (int)syscall(SYS_gettid);
+        pthread_mutex_lock(&traceRingsLock);
+        traceRing->nextRing = traceRings;
+        traceRings = traceRing;
+        pthread_mutex_unlock(&traceRingsLock);
+    }
+
+    unsigned long next = atomic_load_explicit(&traceRing->next, memory_order_relaxed);
+    TraceEvent* event = &traceRing->events[next % TRACE_RING_SIZE];
+    event->name = name;
+    event->start = start;
+    event->duration = duration;
+    atomic_store_explicit(&traceRing->next, next + 1, memory_order_release);
+}
+
+/**
+ * @brief Adds the time since '*mark' to a phase total, and moves the mark
+ * on; for breaking a loop's time down by phase. Does nothing when not
+ * tracing ('*mark' is 0).
+ * @param phase The phase's running total, in nanoseconds.
+ * @param mark When the phase started.
+ */
+void tracePhase(long long* phase, long long* mark) {
+    if (*mark != 0) {
+        long long now = nowNanos();
+        *phase += now - *mark;
+        *mark = now;
+    }
+}
+
+/**
+ * @brief Writes every thread's recorded spans as Chrome trace JSON.
+ * Spans still being recorded by other threads may be left out.
+ * @param path The file to write (NULL = the --trace file).
+ * @return The number of spans written, or -1 if not tracing or the
+ * file couldn't be written.
+ */
+long writeTrace(const char* path) {
+    FILE* file;
+    TraceRing* ring;
+    long written = 0;
+    int pid = (int)getpid();
+
+    if (!traceEnabled) {
+        return -1;
+    }
+    if (path == NULL) {
+        path = traceFile;
+    }
+    file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Error: Could not open file %s for writing.\n", path);
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_lock(&traceRingsLock);
+    for (ring = traceRings; ring != NULL; ring = ring->nextRing) {
+        unsigned long next = atomic_load_explicit(&ring->next, memory_order_acquire);
+        unsigned long first = next > TRACE_RING_SIZE ? next - TRACE_RING_SIZE : 0;
+        unsigned long i;
+
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s %d\"}}",
+                written > 0 || ring != traceRings ? "," : "", pid, ring->tid,
+                ring->tid == pid ? "main" : "thread", ring->tid);
+        for (i = first; i < next; i++) {
+            const TraceEvent* event = &ring->events[i % TRACE_RING_SIZE];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d}",
+                    event->name, event->start / 1e3, event->duration / 1e3, pid, ring->tid);
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&traceRingsLock);
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        printf("Error: Could not write %s (%s).\n", path, strerror(errno));
+        return -1;
+    }
+    return written;
+}
+
+/**
+ * @brief atexit() handler: writes the trace to the --trace file.
+ */
+void writeTraceAtExit(void) {
+    long written = writeTrace(NULL);
+    if (written >= 0) {
+        fprintf(stderr, "Wrote %ld trace spans to %s.\n", written, traceFile);
+    }
+}
+
+// --- Metrics ---
+//
+// GET /metrics answers with counters and gauges in the Prometheus text
+// format, for a scraper (or curl) on the server's local port. Counters
+// bumped on hot paths live in the registry: each thread counts into its
+// own cache-line-aligned MetricBlock with plain (relaxed) stores, so
+// counting costs no lock and no shared cache line. The page adds up every
+// block. Gauges (tasks, queue depths) are read from the server when the
+// page is asked for. With --threads they describe the shard that took
+// the request; registry counters cover the whole process.
+
+static MetricBlock* metricBlocks;        // Every thread's block
+static pthread_mutex_t metricBlocksLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread MetricBlock* metricBlock; // This thread's block (made on first use)
+
+static const MetricInfo metricInfo[METRICS] = {
+    { "todo_operations_total", "op=\"add\"", "Task list operations run." },
+    { "todo_operations_total", "op=\"list\"", NULL },
+    { "todo_operations_total", "op=\"mark\"", NULL },
+    { "todo_operations_total", "op=\"delete\"", NULL },
+    { "todo_operations_total", "op=\"load\"", NULL },
+    { "todo_operations_total", "op=\"save\"", NULL },
+    { "todo_http_requests_total", "result=\"handled\"", "HTTP requests run or refused with 503." },
+    { "todo_http_requests_total", "result=\"shed\"", NULL },
+    { "todo_file_read_bytes_total", "", "Bytes read from task files." },
+    { "todo_file_written_bytes_total", "", "Bytes written to task files." },
+    { "todo_list_cache_lookups_total", "result=\"hit\"",
+      "Workspace lists asked for that were already in memory (hit) or had to be loaded (miss)." },
+    { "todo_list_cache_lookups_total", "result=\"miss\"", NULL },
+    { "todo_sync_lines_total", "result=\"reused\"",
+      "Task file lines seen when syncing an edited file: unchanged (reused) or parsed again." },
+    { "todo_sync_lines_total", "result=\"parsed\"", NULL }
+};
+
+/**
+ * @brief Adds to a registry counter, on this thread's block.
+ * @param metric The counter.
+ * @param amount How much to add.
+ */
+void metricAdd(Metric metric, unsigned long amount) {
+    MetricBlock* block = metricBlock;
+
+    if (block == NULL) {
+        block = (MetricBlock*)aligned_alloc(64, sizeof(MetricBlock));
+        if (block == NULL) {
+            printf("Error: Could not allocate memory for metrics.\n");
+            exit(1);
+        }
+        memset(block, 0, sizeof(*block));
+        pthread_mutex_lock(&metricBlocksLock);
+        block->nextBlock = metricBlocks;
+        metricBlocks = block;
+        pthread_mutex_unlock(&metricBlocksLock);
+        metricBlock = block;
+    }
+    // Only this thread writes the block, so this needn't be an atomic
+    // add; the atomic store just keeps a reader from seeing a torn value.
+    __atomic_store_n(&block->counts[metric], block->counts[metric] + amount, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Adds up a registry counter over every thread. Blocks outlive
+ * their threads, so totals never go backwards.
+ * @param metric The counter.
+ * @return The total.
+ */
+unsigned long metricTotal(Metric metric) {
+    unsigned long total = 0;
+    MetricBlock* block;
+
+    pthread_mutex_lock(&metricBlocksLock);
+    for (block = metricBlocks; block != NULL; block = block->nextBlock) {
+        total += __atomic_load_n(&block->counts[metric], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&metricBlocksLock);
+    return total;
+}
+
+/**
+ * @brief Writes one sample to the metrics page, preceded by its family's
+ * HELP and TYPE lines if it's the first of the family.
+ * @param page The page.
+ * @param family The metric name.
+ * @param type "counter" or "gauge".
+ * @param help What it measures.
+ * @param labels e.g. "op=\"add\"" ("" = none).
+ * @param value The value.
+ */
+void metricsPut(MetricsPage* page, const char* family, const char* type, const char* help,
+                const char* labels, unsigned long long value) {
+    int length;
+
+    if (page->family == NULL || strcmp(page->family, family) != 0) {
+        length = snprintf(page->out + page->used, page->room - page->used,
+                          "# HELP %s %s\n# TYPE %s %s\n", family, help, family, type);
+        if (length < 0 || (size_t)length >= page->room - page->used) {
+            return; // Full; METRICS_PAGE_SIZE is meant to leave room to spare.
+        }
+        page->used += (size_t)length;
+        page->family = family;
+    }
+    length = snprintf(page->out + page->used, page->room - page->used,
+                      *labels != '\0' ? "%s{%s} %llu\n" : "%s%s %llu\n", family, labels, value);
+    if (length > 0 && (size_t)length < page->room - page->used) {
+        page->used += (size_t)length;
+    }
+}
+
+/**
+ * @brief Writes the GET /metrics page.
+ * @param server The server.
+ * @param out Where to write.
+ * @param room Bytes available at 'out'.
+ * @return Bytes written, not counting the NUL.
+ */
+size_t writeMetrics(Server* server, char* out, size_t room) {
+    MetricsPage page;
+    Workspace* workspace = &server->workspace;
+    ListEntry* entry;
+    unsigned long long tasks = 0;
+    unsigned long long done = 0;
+    unsigned long long fileBytes = 0;
+    unsigned long long unsaved = 0;
+    unsigned long long subscribers = 0;
+    unsigned long long backlog = 0;
+    unsigned long long forwardQueue = 0;
+    unsigned long long followers = 0;
+    int lists = 0;
+    int i;
+
+    page.out = out;
+    page.room = room;
+    page.used = 0;
+    page.family = NULL;
+    out[0] = '\0';
+
+    // The registry: counted as they happen, on whichever thread.
+    for (i = 0; i < METRICS; i++) {
+        const MetricInfo* info = &metricInfo[i];
+        metricsPut(&page, info->family, "counter",
+                   info->help != NULL ? info->help : "", info->labels, metricTotal((Metric)i));
+    }
+
+    // The lists in memory.
+    for (entry = workspace->entries; entry != NULL; entry = entry->next) {
+        TaskList* list = entry->list;
+        Subscriber* subscriber;
+        if (list == NULL) {
+            continue;
+        }
+        lists++;
+        tasks += (unsigned long long)list->count;
+        done += (unsigned long long)list->done;
+        fileBytes += (unsigned long long)list->fileSize;
+        unsaved += list->version - list->savedVersion;
+        for (subscriber = list->subscribers; subscriber != NULL; subscriber = subscriber->next) {
+            subscribers++;
+            if (subscriber->tail - subscriber->head > backlog) {
+                backlog = subscriber->tail - subscriber->head;
+            }
+        }
+    }
+    metricsPut(&page, "todo_tasks", "gauge", "Live tasks in the lists in memory.", "", tasks);
+    metricsPut(&page, "todo_tasks_open", "gauge", "Live tasks not yet complete.", "", tasks - done);
+    metricsPut(&page, "todo_tasks_done", "gauge", "Live tasks marked complete.", "", done);
+    metricsPut(&page, "todo_lists_loaded", "gauge", "Lists in memory.", "", (unsigned long long)lists);
+    metricsPut(&page, "todo_lists_loaded_bytes", "gauge",
+               "Memory used by the lists in memory (as budgeted by --memory-budget).", "",
+               workspace->loadedBytes);
+    metricsPut(&page, "todo_list_evictions_total", "counter",
+               "Lists saved and dropped from memory to stay in budget.", "", workspace->evictions);
+    metricsPut(&page, "todo_file_bytes", "gauge",
+               "Size of the task files, as of their last load, save or sync.", "", fileBytes);
+    metricsPut(&page, "todo_unsaved_changes", "gauge",
+               "Changes made since the lists were last loaded or saved.", "", unsaved);
+
+    // Queues.
+    for (i = 0; i < REPL_MAX_FOLLOWERS; i++) {
+        followers += server->replication.followers[i].fd >= 0;
+    }
+    if (server->shard != NULL) {
+        ShardGroup* group = server->shard->group;
+        for (i = 0; i < group->count; i++) {
+            ShardQueue* queue = group->requests[i * group->count + server->shard->index];
+            if (queue != NULL) {
+                forwardQueue += atomic_load_explicit(&queue->tail, memory_order_relaxed) -
+                                atomic_load_explicit(&queue->head, memory_order_relaxed);
+            }
+        }
+    }
+    metricsPut(&page, "todo_http_connections", "gauge", "Open HTTP connections.", "",
+               (unsigned long long)server->connections);
+    metricsPut(&page, "todo_http_queued_requests", "gauge",
+               "Complete requests waiting to be run.", "", (unsigned long long)server->queuedRequests);
+    metricsPut(&page, "todo_http_peak_queued_requests", "gauge",
+               "Most requests ever waiting at once.", "", (unsigned long long)server->peakQueued);
+    metricsPut(&page, "todo_http_shed_connections_total", "counter",
+               "Connections refused with 503 because the server was full.", "",
+               server->shedConnections);
+    metricsPut(&page, "todo_async_jobs", "gauge", "Async jobs (e.g. saves) in progress.", "",
+               server->executor.spawned - server->executor.completed);
+    metricsPut(&page, "todo_subscribers", "gauge", "Connections streaming changes.", "", subscribers);
+    metricsPut(&page, "todo_subscriber_backlog", "gauge",
+               "Changes the furthest-behind subscriber has yet to be sent.", "", backlog);
+    metricsPut(&page, "todo_shard_queued_requests", "gauge",
+               "Requests other shards have forwarded to this one, waiting (--threads).", "",
+               forwardQueue);
+    metricsPut(&page, "todo_replication_followers", "gauge", "Followers being fed (--replicate).",
+               "", followers);
+    return page.used;
+}
+
+// --- Startup Profile ---
+//
+// ./todo --profile-startup starts up as usual, then instead of showing
+// the menu prints where the time went, from main() to the first
+// printMenu(): setting up, then loading the task file (opening it,
+// reading lines, parsing them, making nodes, linking them into the list
+// and indexing the lines), then whatever follows the load.
+//
+// ./todo --bench-startup [MAX_TASKS] times whole starts: for task files of
+// 1,000 tasks, then 10x more each round up to MAX_TASKS, it runs
+// "todo --profile-startup" BENCH_STARTUP_RUNS times with the file dropped
+// from the page cache first (cold) and BENCH_STARTUP_RUNS times with it
+// cached (warm), and prints one JSON object per size and cache state:
+//
+//   {"op":"startup","cache":"cold","tasks":100000,"runs":5,
+//    "median_ms":81.3,"min_ms":79.9,"max_ms":88.0,"resident_pct":0}
+//
+// The times are wall clock from fork() to exit, so they include exec,
+// dynamic linking and exit. 'resident_pct' is how much of the file was
+// still cached when a cold run started; above 0, the kernel didn't drop
+// it all and the cold numbers are flattering. The todo binary itself
+// stays cached.
+
+static int profilingStartup;                 // --profile-startup
+static long long startupLoadPhases[LOAD_PHASES]; // Summed over every load so far
+
+static const char* const loadPhaseNames[LOAD_PHASES] = {
+    "open", "read", "parse", "create nodes", "link list", "index lines"
+};
+
+/**
+ * @brief Turns on load phase timing for --profile-startup.
+ */
+void startStartupProfile(void) {
+    profilingStartup = 1;
+}
+
+/**
+ * @brief Starts timing a load's phases, if anyone wants them.
+ * @return nowNanos(), or 0 when neither profiling nor tracing.
+ */
+long long loadProfileBegin(void) {
+    return profilingStartup ? nowNanos() : traceBegin("load").started;
+}
+
+/**
+ * @brief Finishes timing a load's phases: turns the sampled lines' phase
+ * times into shares of the whole read loop, records them as trace spans
+ * (one after another, under "load") and adds them to the startup profile.
+ * @param phases Phase times: LOAD_OPEN is ignored, the rest are from the
+ * sampled lines only. Receives the estimated phase times.
+ * @param begun loadProfileBegin()'s result.
+ * @param opened When the file was open and reading began.
+ * @param finished When the read loop ended.
+ */
+void loadProfileEnd(long long* phases, long long begun, long long opened, long long finished) {
+    long long sampled = 0;
+    long long at = begun;
+    int i;
+
+    phases[LOAD_OPEN] = opened - begun;
+    for (i = LOAD_READ; i < LOAD_PHASES; i++) {
+        sampled += phases[i];
+    }
+    for (i = LOAD_READ; i < LOAD_PHASES; i++) {
+        phases[i] = sampled > 0 ? (long long)((double)(finished - opened) * phases[i] / sampled) : 0;
+    }
+    if (sampled == 0) {
+        phases[LOAD_READ] = finished - opened; // Empty file: it was all reading.
+    }
+    for (i = 0; i < LOAD_PHASES; i++) {
+        traceRecord(loadPhaseNames[i], at, phases[i]); // If tracing
+        at += phases[i];
+        startupLoadPhases[i] += phases[i];
+    }
+}
+
+/**
+ * @brief Prints where startup time went.
+ * @param out Where to print.
+ * @param list The main list, as loaded.
+ * @param started When main() began.
+ * @param loadStarted When loading the task file began...
+ * @param loadFinished ...and ended.
+ * @param menuAt When the menu would have been shown.
+ */
+void printStartupProfile(FILE* out, const TaskList* list, long long started,
+                         long long loadStarted, long long loadFinished, long long menuAt) {
+    double total = (double)(menuAt - started);
+    long long loadOther = loadFinished - loadStarted;
+    int i;
+
+    fprintf(out, "Startup: %.3f ms from main() to the menu, %d tasks\n",
+            total / 1e6, list->count);
+    fprintf(out, "  %-20s %10.3f ms %5.1f%%\n", "setup",
+            (loadStarted - started) / 1e6, 100.0 * (loadStarted - started) / total);
+    for (i = 0; i < LOAD_PHASES; i++) {
+        fprintf(out, "  %-20s %10.3f ms %5.1f%%\n", loadPhaseNames[i],
+                startupLoadPhases[i] / 1e6, 100.0 * startupLoadPhases[i] / total);
+        loadOther -= startupLoadPhases[i];
+    }
+    fprintf(out, "  %-20s %10.3f ms %5.1f%%\n", "close, other load",
+            loadOther / 1e6, 100.0 * loadOther / total);
+    fprintf(out, "  %-20s %10.3f ms %5.1f%%\n", "after load",
+            (menuAt - loadFinished) / 1e6, 100.0 * (menuAt - loadFinished) / total);
+    fprintf(out, "Phases after open are estimated from every %dth line.\n", LOAD_SAMPLE_EVERY);
+}
+
+/**
+ * @brief Runs the startup benchmarks and prints the results.
+ * @param maxTasks Largest task file to time.
+ * @return 0 on success, 1 on error.
+ */
+int runStartupBench(long maxTasks) {
+    char exe[PATH_MAX];
+    char path[sizeof(BENCH_STARTUP_DIR) + sizeof(FILENAME) + 1];
+    long long runs[BENCH_STARTUP_RUNS];
+    ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    long tasks;
+    int cold;
+    int i;
+
+    if (maxTasks < 1000) {
+        printf("Error: --bench-startup needs at least 1000 tasks.\n");
+        return 1;
+    }
+    if (length < 0) {
+        printf("Error: Could not find the todo binary (%s).\n", strerror(errno));
+        return 1;
+    }
+    exe[length] = '\0';
+    mkdir(BENCH_STARTUP_DIR, 0755); // Fine if it already exists.
+    snprintf(path, sizeof(path), "%s/%s", BENCH_STARTUP_DIR, FILENAME);
+
+    for (tasks = 1000; tasks <= maxTasks; tasks *= 10) {
+        int saved = quietStdout();
+        int failed = generateTaskFile(path, tasks, DEFAULT_SEED, DEFAULT_COMPLETED_PERCENT);
+        restoreStdout(saved);
+        if (failed) {
+            printf("Error: Could not write %s.\n", path);
+            return 1;
+        }
+
+        for (cold = 1; cold >= 0; cold--) {
+            int resident = 0;
+            if (!cold) {
+                timeStartup(exe); // Bring the file back into the cache.
+            }
+            for (i = 0; i < BENCH_STARTUP_RUNS; i++) {
+                if (cold && evictFromCache(path) != 0) {
+                    printf("Error: Could not drop %s from the page cache (%s).\n",
+                           path, strerror(errno));
+                    return 1;
+                }
+                resident += residentPercent(path);
+                runs[i] = timeStartup(exe);
+                if (runs[i] < 0) {
+                    printf("Error: %s --profile-startup failed.\n", exe);
+                    return 1;
+                }
+            }
+            qsort(runs, BENCH_STARTUP_RUNS, sizeof(runs[0]), compareLongLong);
+            printf("{\"op\":\"startup\",\"cache\":\"%s\",\"tasks\":%ld,\"runs\":%d,"
+                   "\"median_ms\":%.1f,\"min_ms\":%.1f,\"max_ms\":%.1f,\"resident_pct\":%d}\n",
+                   cold ? "cold" : "warm", tasks, BENCH_STARTUP_RUNS,
+                   runs[BENCH_STARTUP_RUNS / 2] / 1e6, runs[0] / 1e6,
+                   runs[BENCH_STARTUP_RUNS - 1] / 1e6, resident / BENCH_STARTUP_RUNS);
+            fflush(stdout);
+        }
+    }
+    unlink(path);
+    rmdir(BENCH_STARTUP_DIR);
+    return 0;
+}
+
+/**
+ * @brief Times one start of "todo --profile-startup" on the benchmark
+ * workspace, from fork() to exit.
+ * @param exe The todo binary.
+ * @return Nanoseconds, or -1 if it couldn't be run or failed.
+ */
+long long timeStartup(const char* exe) {
+    long long start = nowNanos();
+    int status;
+    pid_t pid;
+
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execl(exe, exe, "--workspace", BENCH_STARTUP_DIR, "--profile-startup", (char*)NULL);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return nowNanos() - start;
+}
+
+/**
+ * @brief Asks the kernel to drop a file's pages from the page cache.
+ * Dirty pages can't be dropped, so the file is flushed first.
+ * @param path The file.
+ * @return 0 on success, -1 on error (errno set).
+ */
+int evictFromCache(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int result;
+
+    if (fd < 0) {
+        return -1;
+    }
+    fdatasync(fd);
+    result = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    if (result != 0) {
+        errno = result;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Measures how much of a file is in the page cache (mincore()).
+ * @param path The file.
+ * @return Percent of its pages resident, or 0 if it can't be told.
+ */
+int residentPercent(const char* path) {
+    long page = sysconf(_SC_PAGESIZE);
+    struct stat info;
+    unsigned char* pages;
+    size_t count;
+    size_t resident = 0;
+    size_t i;
+    void* mapped;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+    count = ((size_t)info.st_size + (size_t)page - 1) / (size_t)page;
+    pages = (unsigned char*)malloc(count);
+    if (pages == NULL) {
+        printf("Error: Could not allocate memory for page map.\n");
+        exit(1);
+    }
+    if (mincore(mapped, (size_t)info.st_size, pages) == 0) {
+        for (i = 0; i < count; i++) {
+            resident += pages[i] & 1;
+        }
+    }
+    free(pages);
+    munmap(mapped, (size_t)info.st_size);
+    return (int)(100 * resident / count);
+}
+
+// --- Memory Resources ---
+//
+// Task records, the line index and the position array get their memory
+// from one resource per run, picked with --allocator:
+//   malloc     the C library's allocator (the default).
+//   monotonic  carves everything from 1 MB chunks and never takes memory
+//              back until exit: the cheapest allocation there is, for
+//              batch imports and other runs that mostly add.
+//   pool       keeps freed blocks by size and hands them out again, so a
+//              long-running server's churn reuses the same memory.
+//   huge       a pool whose slabs are 2 MB huge pages (explicit ones if
+//              the system has any reserved, transparent ones if not), for
+//              giant lists that would otherwise miss the TLB.
+
+/**
+ * @brief Allocates from the --allocator resource.
+ * @param size Bytes wanted.
+ * @return The block, or NULL if out of memory.
+ */
+void* memoryAllocate(size_t size) {
+    return memoryResource->allocate(memoryResource, size);
+}
+
+/**
+ * @brief Gives a block back to the --allocator resource.
+ * @param block What memoryAllocate() or memoryResize() returned (NULL is ignored).
+ * @param size The size it was allocated with.
+ */
+void memoryRelease(void* block, size_t size) {
+    if (block != NULL) {
+        memoryResource->release(memoryResource, block, size);
+    }
+}
+
+/**
+ * @brief Grows (or shrinks) a block from the --allocator resource,
+ * keeping its contents, like realloc().
+ * @param block The block (NULL = allocate a new one).
+ * @param oldSize The size it was allocated with.
+ * @param newSize The size wanted.
+ * @return The resized block (the old one is released), or NULL if out of
+ * memory (the old one is kept).
+ */
+void* memoryResize(void* block, size_t oldSize, size_t newSize) {
+    if (block == NULL) {
+        return memoryAllocate(newSize);
+    }
+    return memoryResource->resize(memoryResource, block, oldSize, newSize);
+}
+
+/**
+ * @brief Looks up a memory resource by its --allocator name.
+ * @param name "malloc", "monotonic", "pool" or "huge".
+ * @return The resource, or NULL if there's none by that name.
+ */
+MemoryResource* findMemoryResource(const char* name) {
+    size_t i;
+
+    for (i = 0; i < sizeof(memoryResources) / sizeof(memoryResources[0]); i++) {
+        if (strcmp(memoryResources[i].name, name) == 0) {
+            return &memoryResources[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Switches to another memory resource (--allocator). Only before
+ * anything has been allocated: blocks go back to the resource they came from.
+ * @param name A name findMemoryResource() knows.
+ */
+void useMemoryResource(const char* name) {
+    memoryResource = findMemoryResource(name);
+}
+
+/**
+ * @brief "malloc": allocates with malloc().
+ * @param resource The resource.
+ * @param size Bytes wanted.
+ * @return The block, or NULL.
+ */
+void* mallocAllocate(MemoryResource* resource, size_t size) {
+    void* block = malloc(size);
+
+    if (block != NULL) {
+        __atomic_fetch_add(&resource->inUse, size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&resource->reserved, size, __ATOMIC_RELAXED);
+    }
+    return block;
+}
+
+/**
+ * @brief "malloc": frees with free().
+ * @param resource The resource.
+ * @param block The block.
+ * @param size Its size.
+ */
+void mallocRelease(MemoryResource* resource, void* block, size_t size) {
+    free(block);
+    __atomic_fetch_sub(&resource->inUse, size, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&resource->reserved, size, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief "malloc": resizes with realloc().
+ * @param resource The resource.
+ * @param block The block.
+ * @param oldSize Its size.
+ * @param newSize The size wanted.
+ * @return The resized block, or NULL.
+ */
+void* mallocResize(MemoryResource* resource, void* block, size_t oldSize, size_t newSize) {
+    void* grown = realloc(block, newSize);
+
+    if (grown != NULL) {
+        __atomic_fetch_add(&resource->inUse, newSize - oldSize, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&resource->reserved, newSize - oldSize, __ATOMIC_RELAXED);
+    }
+    return grown;
+}
+
+/**
+ * @brief "monotonic": hands out the next bytes of the current chunk,
+ * starting a new chunk when it runs out. Blocks bigger than a quarter of
+ * a chunk get a chunk of their own.
+ * @param resource The resource.
+ * @param size Bytes wanted.
+ * @return The block, or NULL.
+ */
+void* monotonicAllocate(MemoryResource* resource, size_t size) {
+    size_t bytes = (size + POOL_GRAIN - 1) / POOL_GRAIN * POOL_GRAIN;
+    char* block;
+
+    pthread_mutex_lock(&resource->lock);
+    if (bytes > MONOTONIC_CHUNK / 4) {
+        block = (char*)malloc(bytes);
+        if (block != NULL) {
+            resource->reserved += bytes;
+        }
+    } else {
+        if (resource->left < bytes) {
+            char* chunk = (char*)malloc(MONOTONIC_CHUNK);
+            if (chunk == NULL) {
+                pthread_mutex_unlock(&resource->lock);
+                return NULL;
+            }
+            resource->free = chunk; // The rest of the old chunk is never used
+            resource->left = MONOTONIC_CHUNK;
+            resource->reserved += MONOTONIC_CHUNK;
+        }
+        block = resource->free;
+        resource->free += bytes;
+        resource->left -= bytes;
+    }
+    if (block != NULL) {
+        resource->inUse += bytes;
+    }
+    pthread_mutex_unlock(&resource->lock);
+    return block;
+}
+
+/**
+ * @brief "monotonic": releasing only updates the count; the memory stays
+ * with the resource until exit.
+ * @param resource The resource.
+ * @param block The block.
+ * @param size Its size.
+ */
+void monotonicRelease(MemoryResource* resource, void* block, size_t size) {
+    (void)block;
+    __atomic_fetch_sub(&resource->inUse, (size + POOL_GRAIN - 1) / POOL_GRAIN * POOL_GRAIN,
+                       __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief "pool" and "huge": takes a freed block of the same size class
+ * if there is one, else carves one from the current slab. Blocks bigger
+ * than the largest class come from malloc().
+ * @param resource The resource.
+ * @param size Bytes wanted.
+ * @return The block, or NULL.
+ */
+void* poolAllocate(MemoryResource* resource, size_t size) {
+    size_t sizeClass = size > 0 ? (size + POOL_GRAIN - 1) / POOL_GRAIN : 1;
+    size_t bytes = sizeClass * POOL_GRAIN;
+    char* block;
+
+    if (sizeClass > POOL_CLASSES) {
+        block = (char*)malloc(size);
+        if (block != NULL) {
+            __atomic_fetch_add(&resource->inUse, size, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&resource->reserved, size, __ATOMIC_RELAXED);
+        }
+        return block;
+    }
+
+    pthread_mutex_lock(&resource->lock);
+    block = (char*)resource->freeBlocks[sizeClass - 1];
+    if (block != NULL) {
+        resource->freeBlocks[sizeClass - 1] = *(void**)block;
+    } else {
+        if (resource->left < bytes) {
+            char* slab = resource->hugePages ? (char*)hugePageSlab()
+                                             : (char*)malloc(resource->slabSize);
+            if (slab == NULL) {
+                pthread_mutex_unlock(&resource->lock);
+                return NULL;
+            }
+            resource->free = slab; // The rest of the old slab is never used
+            resource->left = resource->slabSize;
+            resource->reserved += resource->slabSize;
+        }
+        block = resource->free;
+        resource->free += bytes;
+        resource->left -= bytes;
+    }
+    resource->inUse += bytes;
+    pthread_mutex_unlock(&resource->lock);
+    return block;
+}
+
+/**
+ * @brief "pool" and "huge": puts a block on its size class's free list
+ * (or frees it, if it came from malloc()).
+ * @param resource The resource.
+ * @param block The block.
+ * @param size Its size.
+ */
+void poolRelease(MemoryResource* resource, void* block, size_t size) {
+    size_t sizeClass = size > 0 ? (size + POOL_GRAIN - 1) / POOL_GRAIN : 1;
+
+    if (sizeClass > POOL_CLASSES) {
+        free(block);
+        __atomic_fetch_sub(&resource->inUse, size, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&resource->reserved, size, __ATOMIC_RELAXED);
+        return;
+    }
+    pthread_mutex_lock(&resource->lock);
+    *(void**)block = resource->freeBlocks[sizeClass - 1];
+    resource->freeBlocks[sizeClass - 1] = block;
+    resource->inUse -= sizeClass * POOL_GRAIN;
+    pthread_mutex_unlock(&resource->lock);
+}
+
+/**
+ * @brief Resizes for the resources that can't grow a block in place:
+ * allocates the new size, copies, releases the old block. A pool's
+ * blocks that are too big for it both ways are realloc()ed instead.
+ * @param resource The resource.
+ * @param block The block.
+ * @param oldSize Its size.
+ * @param newSize The size wanted.
+ * @return The resized block, or NULL.
+ */
+void* copyResize(MemoryResource* resource, void* block, size_t oldSize, size_t newSize) {
+    void* grown;
+
+    if (resource->slabSize > 0 && oldSize > POOL_GRAIN * POOL_CLASSES &&
+        newSize > POOL_GRAIN * POOL_CLASSES) {
+        return mallocResize(resource, block, oldSize, newSize);
+    }
+    grown = resource->allocate(resource, newSize);
+    if (grown != NULL) {
+        memcpy(grown, block, oldSize < newSize ? oldSize : newSize);
+        resource->release(resource, block, oldSize);
+    }
+    return grown;
+}
+
+/**
+ * @brief Maps one huge page for the "huge" pool: an explicit one if any
+ * are reserved (vm.nr_hugepages), else an aligned range the kernel is
+ * asked to back with a transparent huge page.
+ * @return HUGE_PAGE_SIZE bytes, or NULL.
+ */
+void* hugePageSlab(void) {
+    char* range;
+    char* aligned;
+    void* page = mmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (page != MAP_FAILED) {
+        return page;
+    }
+    // Twice the size, so a huge-page-aligned range fits inside; the ends
+    // are handed back.
+    range = (char*)mmap(NULL, 2 * HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (range == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = (char*)(((uintptr_t)range + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > range) {
+        munmap(range, (size_t)(aligned - range));
+    }
+    munmap(aligned + HUGE_PAGE_SIZE, (size_t)(range + HUGE_PAGE_SIZE - aligned));
+    madvise(aligned, HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+    return aligned;
+}
+
+// --- Batch Operations ---
+//
+// Adding, marking or deleting many tasks in one call. A batch commits as
+// one version (a snapshot sees all of it or none), walks the list at most
+// once, grows the position array once, and is written to the task file
+// in one go: appendTasks() for adds, one writeTasks() for the rest.
+// Subscribers and followers still get one change event per task, all
+// with the batch's version.
+
+/**
+ * @brief Appends many tasks at once.
+ * @param list A pointer to the list.
+ * @param descriptions Their texts, in order.
+ * @param count How many.
+ * @return The first new task (NULL if count is 0), for appendTasks().
+ */
+Task* addTasks(TaskList* list, const TextView* descriptions, int count) {
+    LIST_LOCK(list);
+    TRACE_SPAN("add batch");
+    unsigned long version = list->version + 1;
+    Task* first = NULL;
+    Task* last = NULL;
+    Task* task;
+    int i;
+
+    if (count <= 0) {
+        return NULL;
+    }
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    positionsReserve(list, list->count + count);
+#endif
+
+    // 1. Make the records and chain them together, off the list.
+    for (i = 0; i < count; i++) {
+        task = createTaskView(descriptions[i]);
+        task->beginVersion = version;
+        task->id = list->nextId++;
+        if (last == NULL) {
+            first = task;
+        } else {
+            last->next = task;
+        }
+        last = task;
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+        list->positions[list->count + i] = task;
+#endif
+    }
+
+    // 2. Splice the chain on at the tail and commit it, once.
+    if (list->head == NULL) {
+        list->head = first;
+    } else {
+        list->tail->next = first;
+    }
+    list->tail = last;
+    list->version = version;
+    for (task = first; task != NULL; task = task->next) {
+        list->count++;
+        publishChange(list, CHANGE_ADD, list->count, task);
+    }
+    metricAdd(METRIC_OP_ADD, (unsigned long)count);
+    return first;
+}
+
+/**
+ * @brief Marks many tasks complete in one walk of the list.
+ * @param list A pointer to the list.
+ * @param indices Their 1-based indices, in any order. Ones out of range
+ * or repeated are skipped.
+ * @param count How many indices.
+ * @return How many tasks were marked (or were already complete).
+ */
+int completeTasks(TaskList* list, const int* indices, int count) {
+    LIST_LOCK(list);
+    TRACE_SPAN("mark batch");
+    unsigned long before = list->version;
+    unsigned long version = before + 1;
+    int* sorted;
+    int valid = sortBatchIndices(list, indices, count, &sorted);
+    Task* current = list->head;
+    int position = 0;
+    int next = 0;
+
+    if (valid == 0) {
+        free(sorted); // Nothing to mark: no new version, no events
+        return 0;
+    }
+    // The events carry the batch's version, so it's set first. The walk
+    // reads the list as of 'before': it skips the new records and still
+    // counts the ones they replace, so positions stay those of the list
+    // before the batch.
+    list->version = version;
+    while (current != NULL && next < valid) {
+        if (isVisible(current, before) && ++position == sorted[next]) {
+            next++;
+            if (!current->completed) {
+                if (list->snapshotCount == 0) {
+                    current->completed = 1;
+                } else {
+                    // As in completeTask(): a new version of the record,
+                    // right after the old one, which older snapshots keep.
+                    Task* newer = createTask(current->description);
+                    newer->completed = 1;
+                    newer->id = current->id;
+                    newer->beginVersion = version;
+                    newer->next = current->next;
+                    current->next = newer;
+                    if (list->tail == current) {
+                        list->tail = newer;
+                    }
+                    current->endVersion = version;
+                    list->garbage++;
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+                    list->positions[position - 1] = newer;
+#endif
+                }
+                list->done++;
+                publishChange(list, CHANGE_MARK, position, current);
+            }
+        }
+        current = current->next;
+    }
+    free(sorted);
+    metricAdd(METRIC_OP_MARK, (unsigned long)valid);
+    return valid;
+}
+
+/**
+ * @brief Deletes many tasks in one walk of the list.
+ * @param list A pointer to the list.
+ * @param indices Their 1-based indices (positions before the batch), in
+ * any order. Ones out of range or repeated are skipped.
+ * @param count How many indices.
+ * @return How many tasks were deleted.
+ */
+int removeTasks(TaskList* list, const int* indices, int count) {
+    LIST_LOCK(list);
+    TRACE_SPAN("delete batch");
+    unsigned long before = list->version;
+    unsigned long version = before + 1;
+    int* sorted;
+    int valid = sortBatchIndices(list, indices, count, &sorted);
+    int unlinked = (list->snapshotCount == 0);
+    Task* previous = NULL;
+    Task* current = list->head;
+    int position = 0;
+    int next = 0;
+
+    if (valid == 0) {
+        free(sorted); // As in completeTasks()
+        return 0;
+    }
+    // As in completeTasks(): committed first, walked as of 'before'.
+    list->version = version;
+    while (current != NULL && next < valid) {
+        Task* following = current->next;
+
+        if (isVisible(current, before) && ++position == sorted[next]) {
+            // Events are applied one after another, so each index is
+            // where the task is once the earlier deletes have happened.
+            publishChange(list, CHANGE_DELETE, position - next, current);
+            next++;
+            list->done -= current->completed;
+            if (unlinked) {
+                if (previous == NULL) {
+                    list->head = following;
+                } else {
+                    previous->next = following;
+                }
+                if (list->tail == current) {
+                    list->tail = previous;
+                }
+                destroyTask(current);
+                current = following;
+                continue;
+            }
+            // Left linked for older snapshots, invisible from 'version' on.
+            current->endVersion = version;
+            list->garbage++;
+        }
+        previous = current;
+        current = following;
+    }
+
+#if TODO_STORAGE == TODO_STORAGE_INDEXED
+    // Close up the position array in one pass.
+    int kept = 0;
+    int i;
+    next = 0;
+    for (i = 0; i < list->count; i++) {
+        if (next < valid && i == sorted[next] - 1) {
+            next++;
+            continue;
+        }
+        list->positions[kept++] = list->positions[i];
+    }
+#endif
+    list->count -= valid;
+    free(sorted);
+    metricAdd(METRIC_OP_DELETE, (unsigned long)valid);
+    return valid;
+}
+
+/**
+ * @brief Sorts a batch's indices and drops the ones that are out of
+ * range or repeated.
+ * @param list The list the indices are into.
+ * @param indices The indices.
+ * @param count How many.
+ * @param sorted Receives the result (malloc'd; the caller frees it).
+ * @return How many indices are left.
+ */
+int sortBatchIndices(const TaskList* list, const int* indices, int count, int** sorted) {
+    int* result = (int*)malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    int valid = 0;
+    int i;
+
+    if (result == NULL) {
+        printf("Error: Could not allocate memory for batch.\n");
+        exit(1);
+    }
+    for (i = 0; i < count; i++) {
+        if (indices[i] >= 1 && indices[i] <= list->count) {
+            result[valid++] = indices[i];
+        }
+    }
+    qsort(result, (size_t)valid, sizeof(int), compareIndices);
+    count = valid;
+    valid = 0;
+    for (i = 0; i < count; i++) {
+        if (valid == 0 || result[i] != result[valid - 1]) {
+            result[valid++] = result[i];
+        }
+    }
+    *sorted = result;
+    return valid;
+}
+
+/**
+ * @brief qsort() comparator for task indices.
+ * @param a One index.
+ * @param b Another.
+ * @return Negative, zero or positive, as for strcmp().
+ */
+int compareIndices(const void* a, const void* b) {
+    int left = *(const int*)a;
+    int right = *(const int*)b;
+
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief qsort() and bsearch() comparator for task ids.
+ * @param a One id.
+ * @param b Another.
+ * @return Negative, zero or positive, as for strcmp().
+ */
+int compareIds(const void* a, const void* b) {
+    unsigned long left = *(const unsigned long*)a;
+    unsigned long right = *(const unsigned long*)b;
+
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief Writes tasks just added to the end of the list's file, in one
+ * write(): the journal entry for addTask() or addTasks(). The file must
+ * hold exactly the list as it was before that call, as left by the last
+ * save or append, and be empty or end in a newline; if not, the whole
+ * list is saved instead.
+ * @param list A pointer to the list.
+ * @param first The first task added (the rest follow it to the tail).
+ * @return 0, or -1 (errno set) if the file couldn't be written.
+ */
+int appendTasks(TaskList* list, Task* first) {
+    LIST_LOCK(list);
+    TRACE_SPAN("append batch");
+    struct stat info;
+    size_t used = 0;
+    size_t room = 0;
+    char* data = NULL;
+    Task* task;
+    int indexed = list->lineCount;
+    LineRecord* last = indexed > 0 ? &list->lines[indexed - 1] : NULL;
+    int fd;
+
+    if (first == NULL) {
+        return 0;
+    }
+    // A last line without its newline would run into the first new one.
+    if (last != NULL ? last->offset + (off_t)last->length + 1 != list->fileSize
+                     : list->fileSize != 0) {
+        return writeTasks(list);
+    }
+    if (list->version != list->savedVersion + 1 || stat(list->file, &info) != 0 ||
+        info.st_size != list->fileSize || info.st_mtim.tv_sec != list->fileTime.tv_sec ||
+        info.st_mtim.tv_nsec != list->fileTime.tv_nsec) {
+        return writeTasks(list);
+    }
+
+    // 1. Format every new line, indexing it as we go.
+    for (task = first; task != NULL; task = task->next) {
+        if (!isVisible(task, list->version)) {
+            continue;
+        }
+        if (room - used < MAX_TASK_LEN + 16) {
+            room = room > 0 ? room * 2 : 65536;
+            char* grown = (char*)realloc(data, room);
+            if (grown == NULL) {
+                printf("Error: Could not allocate memory for append.\n");
+                exit(1);
+            }
+            data = grown;
+        }
+        int length = sprintf(data + used, "%d,%s", task->completed, task->description);
+        indexLine(list, list->fileSize + (off_t)used, data + used, (size_t)length, task->id);
+        data[used + (size_t)length] = '\n';
+        used += (size_t)length + 1;
+    }
+
+    // 2. One write for all of them.
+    fd = open(list->file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0 || write(fd, data, used) != (ssize_t)used) {
+        int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(data);
+        list->lineCount = indexed; // Forget the lines that didn't make it
+        errno = error;
+        return -1;
+    }
+    close(fd);
+    free(data);
+    metricAdd(METRIC_BYTES_WRITTEN, (unsigned long)used);
+    recordFileState(list, list->fileSize + (off_t)used);
+    list->savedVersion = list->version;
+    return 0;
+}
+
+// --- Library API ---
+//
+// What libtodo.h declares: a TaskList behind an opaque handle, driven
+// through the functions that don't print (completeTask(), removeTask(),
+// readTasks(), writeTasks(), ...). Everything else in this file is
+// hidden from programs linking libtodo.
+
+struct TodoStore {
+    TaskList list;
+};
+
+/**
+ * @brief Returns the ABI libtodo was built with.
+ * @return TODO_ABI_VERSION.
+ */
+int todoAbiVersion(void) {
+    return TODO_ABI_VERSION;
+}
+
+/**
+ * @brief Opens a task file as a store, loading its tasks.
+ * @param path The file.
+ * @return The store, or NULL (errno set).
+ */
+TodoStore* todoOpen(const char* path) {
+    TodoStore* store;
+
+    if (strlen(path) >= sizeof(store->list.file)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    store = (TodoStore*)malloc(sizeof(TodoStore));
+    if (store == NULL) {
+        printf("Error: Could not allocate memory for store.\n");
+        exit(1);
+    }
+    initList(&store->list);
+    setListFile(&store->list, path);
+    if (readTasks(&store->list) != 0 && errno != ENOENT) {
+        int error = errno;
+        freeList(&store->list);
+        free(store);
+        errno = error;
+        return NULL;
+    }
+    return store;
+}
+
+/**
+ * @brief Appends a task.
+ * @param store The store.
+ * @param description The text, up to its first line break.
+ * @return The new task's index, or -1 (errno EINVAL) if it's empty.
+ */
+int todoAdd(TodoStore* store, const char* description) {
+    TextView view = firstLineView(description);
+
+    // Same rules as POST /tasks: one line, not empty.
+    if (view.length == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    LIST_LOCK(&store->list);
+    addTaskView(&store->list, view);
+    return store->list.count;
+}
+
+/**
+ * @brief Marks a task complete.
+ * @param store The store.
+ * @param index The task's 1-based index.
+ * @return 0, or -1 if there's no such task.
+ */
+int todoMark(TodoStore* store, int index) {
+    return completeTask(&store->list, index);
+}
+
+/**
+ * @brief Deletes a task.
+ * @param store The store.
+ * @param index The task's 1-based index.
+ * @return 0, or -1 if there's no such task.
+ */
+int todoDelete(TodoStore* store, int index) {
+    return removeTask(&store->list, index);
+}
+
+/**
+ * @brief Appends many tasks and journals them with one write.
+ * @param store The store.
+ * @param descriptions Their texts, each up to its first line break.
+ * @param count How many.
+ * @return How many were added, or -1 (errno set) if the write failed or
+ * (EINVAL, nothing added) one of the texts is empty.
+ */
+int todoAddBatch(TodoStore* store, const char* const* descriptions, int count) {
+    TextView* views = (TextView*)malloc((size_t)(count > 0 ? count : 1) * sizeof(TextView));
+    int i;
+
+    if (views == NULL) {
+        printf("Error: Could not allocate memory for batch.\n");
+        exit(1);
+    }
+    for (i = 0; i < count; i++) {
+        views[i] = firstLineView(descriptions[i]);
+        if (views[i].length == 0) {
+            free(views);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    LIST_LOCK(&store->list);
+    Task* first = addTasks(&store->list, views, count);
+    free(views);
+    return appendTasks(&store->list, first) == 0 ? (count > 0 ? count : 0) : -1;
+}
+
+/**
+ * @brief Marks many tasks complete and saves once, if any of them
+ * wasn't complete already.
+ * @param store The store.
+ * @param indices Their 1-based indices.
+ * @param count How many.
+ * @return How many are marked, or -1 (errno set) if the save failed.
+ */
+int todoMarkBatch(TodoStore* store, const int* indices, int count) {
+    LIST_LOCK(&store->list);
+    int done = store->list.done;
+    int marked = completeTasks(&store->list, indices, count);
+
+    // A mark has no journal record (appendTasks() only appends lines),
+    // so the batch is kept by a full save; skip it if nothing changed.
+    if (store->list.done == done) {
+        return marked;
+    }
+    return writeTasks(&store->list) == 0 ? marked : -1;
+}
+
+/**
+ * @brief Deletes many tasks and saves once, if any were deleted.
+ * @param store The store.
+ * @param indices Their 1-based indices.
+ * @param count How many.
+ * @return How many were deleted, or -1 (errno set) if the save failed.
+ */
+int todoDeleteBatch(TodoStore* store, const int* indices, int count) {
+    LIST_LOCK(&store->list);
+    int deleted = removeTasks(&store->list, indices, count);
+
+    // As in todoMarkBatch(): a full save, and only for a change.
+    if (deleted == 0) {
+        return 0;
+    }
+    return writeTasks(&store->list) == 0 ? deleted : -1;
+}
+
+/**
+ * @brief Counts a store's tasks.
+ * @param store The store.
+ * @return How many it holds.
+ */
+int todoCount(TodoStore* store) {
+    LIST_LOCK(&store->list);
+    return store->list.count;
+}
+
+/**
+ * @brief Visits every task (or every match of a query) from a snapshot,
+ * so the visitor may change the list without upsetting the walk.
+ * @param store The store.
+ * @param query Text the description must contain (NULL = every task).
+ * @param visit The visitor.
+ * @param context Passed to the visitor.
+ * @return 0, or the visitor's nonzero return.
+ */
+static int visitTasks(TodoStore* store, const char* query, TodoVisitor visit, void* context) {
+    Snapshot snapshot = openSnapshot(&store->list);
+    Task* current = store->list.head;
+    TodoTask task;
+    int stopped = 0;
+
+    task.index = 0;
+    while (current != NULL && stopped == 0) {
+        if (isVisible(current, snapshot.version)) {
+            task.index++;
+            if (query == NULL || strstr(current->description, query) != NULL) {
+                task.id = current->id;
+                task.completed = current->completed;
+                task.description = current->description;
+                stopped = visit(&task, context);
+            }
+        }
+        current = current->next;
+    }
+    closeSnapshot(&snapshot);
+    return stopped;
+}
+
+/**
+ * @brief Visits every task in order.
+ * @param store The store.
+ * @param visit The visitor.
+ * @param context Passed to the visitor.
+ * @return 0, or the visitor's nonzero return.
+ */
+int todoIterate(TodoStore* store, TodoVisitor visit, void* context) {
+    LATENCY_SCOPE(LATENCY_LIST);
+    return visitTasks(store, NULL, visit, context);
+}
+
+/**
+ * @brief Visits the tasks whose description contains a query.
+ * @param store The store.
+ * @param query The text to look for.
+ * @param visit The visitor.
+ * @param context Passed to the visitor.
+ * @return 0, or the visitor's nonzero return.
+ */
+int todoSearch(TodoStore* store, const char* query, TodoVisitor visit, void* context) {
+    return visitTasks(store, query, visit, context);
+}
+
+/**
+ * @brief Writes a store's tasks to its file.
+ * @param store The store.
+ * @return 0, or -1 (errno set).
+ */
+int todoSave(TodoStore* store) {
+    return writeTasks(&store->list);
+}
+
+/**
+ * @brief Frees a store without saving it.
+ * @param store The store (NULL is ignored).
+ */
+void todoClose(TodoStore* store) {
+    if (store != NULL) {
+        freeList(&store->list);
+        free(store);
+    }
 }